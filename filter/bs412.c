@@ -26,6 +26,7 @@ void init_bs412(BS412Compressor* comp, uint32_t mpx_deviation, float target_powe
 	comp->knee_db = knee_db; // e.g. 6.0f — width in dB around target on each side
 	comp->init = true;
 	comp->strenght = strenght;
+	comp->block_samples = 0;
 	#ifdef BS412_DEBUG
 	debug_printf("Initialized MPX power measurement with sample rate: %d\n", sample_rate);
 	#endif
@@ -41,21 +42,12 @@ void reinit_bs412(BS412Compressor* comp, uint32_t mpx_deviation, float target_po
 	comp->max_gain = max_gain;
 	comp->knee_db = knee_db;
 	comp->strenght = strenght;
+	comp->block_samples = 0;
 }
 
-float bs412_compress(BS412Compressor* comp, float audio, float sample_mpx, float* mpx_power) {
-	float combined = audio + sample_mpx;
-	float output_sample = (audio * comp->gain) + sample_mpx;
-
-	float inst_power = output_sample * output_sample;
-	float audio_power = (audio * comp->gain) * (audio * comp->gain);
-
-	float w = (audio_power - comp->gate_threshold) / comp->gate_threshold;
-	w = CLAMP(w, 0.0f, 1.0f);
-	comp->avg_power += comp->alpha * w * (inst_power - comp->avg_power);
-
+static void count_seconds(BS412Compressor* comp) {
 	if(comp->sample_counter >= comp->sample_rate) {
-		comp->sample_counter = 0;
+		comp->sample_counter -= comp->sample_rate;
 		if(comp->can_compress == 0) comp->second_counter++;
 	}
 
@@ -66,7 +58,10 @@ float bs412_compress(BS412Compressor* comp, float audio, float sample_mpx, float
 		comp->can_compress = 1;
 		comp->second_counter = 0;
 	}
+}
 
+// Moves the gain toward what the averaged power asks for, returns the power in dBr
+static float update_gain(BS412Compressor* comp, float attack, float release) {
 	float safe_power = fmaxf(comp->avg_power, 1e-12f);
 	float temp_gain = sqrtf(comp->target / safe_power);
 	float target_gain = powf(temp_gain, comp->strenght);
@@ -87,9 +82,26 @@ float bs412_compress(BS412Compressor* comp, float audio, float sample_mpx, float
 
 	float blended_target = 1.0f + knee_blend * (target_gain - 1.0f);
 
-	float coeff = (comp->avg_power > comp->target) ? comp->attack : comp->release;
+	float coeff = (comp->avg_power > comp->target) ? attack : release;
 	comp->gain = coeff * comp->gain + (1.0f - coeff) * blended_target;
 	comp->gain = CLAMP(comp->gain, 0.01f, comp->max_gain);
+	return level_dbr;
+}
+
+float bs412_compress(BS412Compressor* comp, float audio, float sample_mpx, float* mpx_power) {
+	float combined = audio + sample_mpx;
+	float output_sample = (audio * comp->gain) + sample_mpx;
+
+	float inst_power = output_sample * output_sample;
+	float audio_power = (audio * comp->gain) * (audio * comp->gain);
+
+	float w = (audio_power - comp->gate_threshold) / comp->gate_threshold;
+	w = CLAMP(w, 0.0f, 1.0f);
+	comp->avg_power += comp->alpha * w * (inst_power - comp->avg_power);
+
+	count_seconds(comp);
+
+	float level_dbr = update_gain(comp, comp->attack, comp->release);
 
 	comp->sample_counter++;
 
@@ -97,4 +109,24 @@ float bs412_compress(BS412Compressor* comp, float audio, float sample_mpx, float
 
 	if(comp->can_compress) return output_sample;
 	return combined;
-}
\ No newline at end of file
+}
+
+bool bs412_compress_block(BS412Compressor* comp, double audio_power, double cross_power, double mpx_power_sum, double weight, uint32_t samples, float* mpx_power) {
+	if(comp->block_samples != samples) {
+		comp->block_samples = samples;
+		comp->block_attack = powf(comp->attack, samples);
+		comp->block_release = powf(comp->release, samples);
+	}
+
+	// The gain was held over the block, so the gated output power comes out of the three sums. alpha is tiny so the block's steps add up linearly
+	double g = comp->gain;
+	double inst_power = g * g * audio_power + 2.0 * g * cross_power + mpx_power_sum;
+	comp->avg_power += comp->alpha * (inst_power - weight * comp->avg_power);
+
+	comp->sample_counter += samples;
+	count_seconds(comp);
+
+	float level_dbr = update_gain(comp, comp->block_attack, comp->block_release);
+	if(mpx_power != NULL) *mpx_power = level_dbr;
+	return comp->can_compress;
+}
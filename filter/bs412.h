@@ -31,8 +31,15 @@ typedef struct {
 	bool init;
 	float knee_db;
 	float strenght;
+
+	// attack and release raised to a block's length, for bs412_compress_block
+	uint32_t block_samples;
+	float block_attack;
+	float block_release;
 } BS412Compressor;
 
 void init_bs412(BS412Compressor *comp, uint32_t mpx_deviation, float target_power, float attack, float release, float max_gain, float gate, float knee_db, float strenght, uint32_t sample_rate);
 void reinit_bs412(BS412Compressor *comp, uint32_t mpx_deviation, float target_power, float attack, float release, float max_gain, float gate, float knee_db, float strenght);
-float bs412_compress(BS412Compressor *comp, float audio, float sample_mpx, float* mpx_power);
\ No newline at end of file
+float bs412_compress(BS412Compressor *comp, float audio, float sample_mpx, float* mpx_power);
+// One update for a block the gain was held over. Takes the sums of audio², audio × mpx and mpx² (mpx being everything but the audio), each sample weighted by the gate, and the sum of the weights. True once the gain should be applied
+bool bs412_compress_block(BS412Compressor *comp, double audio_power, double cross_power, double mpx_power_sum, double weight, uint32_t samples, float* mpx_power);
@@ -13,6 +13,7 @@ void initAGC(AGC* agc, uint32_t sampleRate, float targetLevel, float minGain, fl
 
     agc->currentGain = 1.0f;
     agc->currentLevel = 0.0f;
+    agc->blockSamples = 0;
 }
 
 float process_agc(AGC* agc, float sidechain) {
@@ -33,4 +34,29 @@ float process_agc(AGC* agc, float sidechain) {
     agc->currentGain = gainAlpha * agc->currentGain + (1.0f - gainAlpha) * desiredGain;
 
     return agc->currentGain;
-}
\ No newline at end of file
+}
+
+float process_agc_block(AGC* agc, float meanPower, uint32_t samples) {
+    if(agc->blockSamples != samples) {
+        agc->blockSamples = samples;
+        agc->blockAttackCoef = powf(agc->attackCoef, samples);
+        agc->blockReleaseCoef = powf(agc->releaseCoef, samples);
+        agc->blockRmsAlpha = powf(agc->rmsAlpha, samples);
+    }
+
+    agc->rmsBuffer = agc->blockRmsAlpha * agc->rmsBuffer + (1.0f - agc->blockRmsAlpha) * meanPower;
+
+    const float rmsLevel = sqrtf(agc->rmsBuffer);
+
+    const float levelAlpha = (rmsLevel > agc->currentLevel) ? agc->blockAttackCoef : agc->blockReleaseCoef;
+    agc->currentLevel = levelAlpha * agc->currentLevel + (1.0f - levelAlpha) * rmsLevel;
+
+    float desiredGain = agc->targetLevel / (agc->currentLevel + 1e-9f);
+
+    desiredGain = fminf(fmaxf(desiredGain, agc->minGain), agc->maxGain);
+
+    const float gainAlpha = (desiredGain < agc->currentGain) ? agc->blockAttackCoef : agc->blockReleaseCoef;
+    agc->currentGain = gainAlpha * agc->currentGain + (1.0f - gainAlpha) * desiredGain;
+
+    return agc->currentGain;
+}
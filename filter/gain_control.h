@@ -19,7 +19,15 @@ typedef struct {
 	float rmsBuffer;
 	float rmsAlpha;
 	float rmsBeta;
+
+	// The same coefficients raised to a block's length, for process_agc_block
+	uint32_t blockSamples;
+	float blockAttackCoef;
+	float blockReleaseCoef;
+	float blockRmsAlpha;
 } AGC;
 
 void initAGC(AGC* agc, uint32_t sampleRate, float targetLevel, float minGain, float maxGain, float attackTime, float releaseTime);
-float process_agc(AGC* agc, float sidechain);
\ No newline at end of file
+float process_agc(AGC* agc, float sidechain);
+// One update for a whole block, from the mean power of its sidechain
+float process_agc_block(AGC* agc, float meanPower, uint32_t samples);
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+// Four lane vectors through the GCC/Clang vector extensions, these become SSE on x86 and NEON on ARM
+typedef float v4sf __attribute__((vector_size(16)));
+typedef int32_t v4si __attribute__((vector_size(16)));
+
+static inline v4sf v4sf_load(const float *p) {
+	v4sf v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+static inline void v4sf_store(float *p, v4sf v) { memcpy(p, &v, sizeof(v)); }
+static inline v4si v4si_load(const int32_t *p) {
+	v4si v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+static inline void v4si_store(int32_t *p, v4si v) { memcpy(p, &v, sizeof(v)); }
+
+static inline v4sf v4sf_set1(float x) { return (v4sf){x, x, x, x}; }
+
+static inline v4sf v4sf_select(v4si mask, v4sf a, v4sf b) {
+	return (v4sf)((mask & (v4si)a) | (~mask & (v4si)b));
+}
+static inline v4sf v4sf_clamp(v4sf v, v4sf lo, v4sf hi) {
+	v = v4sf_select(v > hi, hi, v);
+	return v4sf_select(v < lo, lo, v);
+}
+
+// Truncating conversions, like a C cast
+static inline v4si v4sf_to_v4si(v4sf v) { return __builtin_convertvector(v, v4si); }
+static inline v4sf v4si_to_v4sf(v4si v) { return __builtin_convertvector(v, v4sf); }
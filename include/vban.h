@@ -1,6 +1,8 @@
 #pragma once
 
 #include <pulse/simple.h>
+#include <stdint.h>
+#include <string.h>
 
 #define VBAN_SR_MAXNUMBER 21
 static long VBAN_SRList[VBAN_SR_MAXNUMBER] = {
@@ -101,4 +103,12 @@ typedef union {
     VBANPing0Data data;
     char raw_data[sizeof(VBANPing0Data)];
 } VBANPing0DataUnion;
-#pragma pack()
\ No newline at end of file
+#pragma pack()
+
+// Checks the magic and copies the header out, returns the protocol or -1 if this isn't VBAN
+static inline int parse_vban_header(const char* buffer, size_t size, VBANHeader* header) {
+    if (size < sizeof(VBANHeader)) return -1;
+    memcpy(header, buffer, sizeof(VBANHeader));
+    if (memcmp(header->vban, "VBAN", 4) != 0) return -1;
+    return header->protocol_sample_rate_idx & 0xe0;
+}
@@ -0,0 +1,105 @@
+#include "asrc.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define ANTIALIAS_ORDER 8
+#define ANTIALIAS_CUTOFF 0.45 // of the output rate
+
+int init_asrc(Asrc* asrc, uint16_t channels) {
+	asrc->channels = channels;
+	asrc->history = calloc(4 * channels, sizeof(float));
+	if(asrc->history == NULL) return -1;
+	asrc->mu = 0.0;
+	asrc->nominal = 1.0;
+	asrc->ratio = 1.0;
+	asrc->antialias = NULL;
+	return 0;
+}
+
+static void destroy_antialias(Asrc* asrc) {
+	if(asrc->antialias == NULL) return;
+	for(uint16_t c = 0; c < asrc->channels; c++) iirfilt_rrrf_destroy(asrc->antialias[c]);
+	free(asrc->antialias);
+	asrc->antialias = NULL;
+}
+
+void set_asrc_nominal(Asrc* asrc, double nominal) {
+	asrc->nominal = nominal;
+	asrc->ratio = nominal;
+
+	// Going down, the input has to lose what the output can't hold first
+	destroy_antialias(asrc);
+	if(nominal > 1.001) {
+		asrc->antialias = calloc(asrc->channels, sizeof(iirfilt_rrrf));
+		if(asrc->antialias == NULL) return;
+		for(uint16_t c = 0; c < asrc->channels; c++) asrc->antialias[c] = iirfilt_rrrf_create_prototype(LIQUID_IIRDES_CHEBY2, LIQUID_IIRDES_LOWPASS, LIQUID_IIRDES_SOS, ANTIALIAS_ORDER, ANTIALIAS_CUTOFF / nominal, 0.0f, 1.0f, 60.0f);
+	}
+}
+
+void set_asrc_ratio(Asrc* asrc, double drift) {
+	double limit = ASRC_MAX_PPM * 1e-6;
+	if(drift > 1.0 + limit) drift = 1.0 + limit;
+	if(drift < 1.0 - limit) drift = 1.0 - limit;
+	asrc->ratio = asrc->nominal * drift;
+}
+
+size_t process_asrc(Asrc* asrc, const float* in, size_t in_frames, float* out, size_t max_out_frames) {
+	uint16_t ch = asrc->channels;
+	float* h = asrc->history;
+	size_t produced = 0;
+
+	for(size_t i = 0; i < in_frames; i++) {
+		memmove(h, h + ch, 3 * ch * sizeof(float));
+		memcpy(h + 3 * ch, in + i * ch, ch * sizeof(float));
+		if(asrc->antialias != NULL) {
+			for(uint16_t c = 0; c < ch; c++) iirfilt_rrrf_execute(asrc->antialias[c], h[3 * ch + c], &h[3 * ch + c]);
+		}
+
+		while(asrc->mu < 1.0 && produced < max_out_frames) {
+			float mu = (float)asrc->mu;
+			for(uint16_t c = 0; c < ch; c++) {
+				float x0 = h[c], x1 = h[ch + c], x2 = h[2 * ch + c], x3 = h[3 * ch + c];
+				float c1 = x2 - x0 * (1.0f / 3.0f) - x1 * 0.5f - x3 * (1.0f / 6.0f);
+				float c2 = (x0 + x2) * 0.5f - x1;
+				float c3 = (x3 - x0) * (1.0f / 6.0f) + (x1 - x2) * 0.5f;
+				out[produced * ch + c] = ((c3 * mu + c2) * mu + c1) * mu + x1;
+			}
+			produced++;
+			asrc->mu += asrc->ratio;
+		}
+		asrc->mu -= 1.0;
+	}
+	return produced;
+}
+
+void exit_asrc(Asrc* asrc) {
+	destroy_antialias(asrc);
+	free(asrc->history);
+	asrc->history = NULL;
+}
+
+void init_drift_estimator(DriftEstimator* de, double kp, double ki, double smoothing) {
+	de->fill = -1.0;
+	de->integral = 0.0;
+	de->kp = kp;
+	de->ki = ki;
+	de->smoothing = smoothing;
+}
+
+// Returns the ratio to run the resampler at, dt is the time that passed since the last update
+double update_drift_estimator(DriftEstimator* de, double fill, double target, double dt) {
+	if(de->fill < 0) de->fill = fill;
+	double alpha = dt / de->smoothing;
+	if(alpha > 1.0) alpha = 1.0;
+	de->fill += (fill - de->fill) * alpha;
+
+	double error = de->fill - target;
+	de->integral += de->ki * error * dt;
+
+	double limit = ASRC_MAX_PPM * 1e-6;
+	if(de->integral > limit) de->integral = limit;
+	if(de->integral < -limit) de->integral = -limit;
+
+	return 1.0 + de->integral + de->kp * error;
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <liquid/liquid.h>
+
+#define ASRC_MAX_PPM 1000.0 // the furthest the drift correction may go from 1
+
+// Asynchronous resampler, cubic Lagrange interpolation in Farrow form on interleaved frames
+typedef struct {
+	uint16_t channels;
+	float* history; // last four input frames, oldest first
+	double mu; // position between history frames 1 and 2
+	double nominal; // input rate over output rate
+	double ratio; // input frames per output frame, the nominal one with the drift correction on top
+	iirfilt_rrrf* antialias; // one per channel, only when going down in rate
+} Asrc;
+
+int init_asrc(Asrc* asrc, uint16_t channels);
+void set_asrc_nominal(Asrc* asrc, double nominal);
+void set_asrc_ratio(Asrc* asrc, double drift);
+size_t process_asrc(Asrc* asrc, const float* in, size_t in_frames, float* out, size_t max_out_frames);
+void exit_asrc(Asrc* asrc);
+
+// Keeps a buffer at its target depth by steering the ratio, the integral is the clock mismatch
+typedef struct {
+	double fill; // smoothed
+	double integral;
+	double kp;
+	double ki;
+	double smoothing;
+} DriftEstimator;
+
+void init_drift_estimator(DriftEstimator* de, double kp, double ki, double smoothing);
+double update_drift_estimator(DriftEstimator* de, double fill, double target, double dt);
@@ -1,4 +1,5 @@
 #include "audio.h"
+#include "sample_format.h"
 
 int init_PulseInputDevice(PulseInputDevice* dev, const int sample_rate, const int channels, const char* app_name, const char *stream_name, const char* device, pa_buffer_attr* buffer_attr, enum pa_sample_format format) {
 	#ifdef PULSE_DEBUG
@@ -77,3 +78,21 @@ int write_PulseOutputDevice(PulseOutputDevice* dev, void* buffer, size_t size) {
 	if(pa_simple_write(dev->dev, buffer, size, &error) == 0) return 0;
 	return error;
 }
+
+int latency_PulseOutputDevice(PulseOutputDevice* dev, pa_usec_t* latency) {
+	if (!dev->initialized) return PA_ERR_BADSTATE;
+	int error = 0;
+	*latency = pa_simple_get_latency(dev->dev, &error);
+	if(*latency == (pa_usec_t)-1) return error;
+	return 0;
+}
+
+enum pa_sample_format pulse_sample_format(uint8_t format) {
+	switch(format) {
+		case SAMPLE_U8: return PA_SAMPLE_U8;
+		case SAMPLE_S16: return PA_SAMPLE_S16NE;
+		case SAMPLE_S24: return PA_SAMPLE_S24LE;
+		case SAMPLE_S32: return PA_SAMPLE_S32NE;
+		default: return PA_SAMPLE_FLOAT32NE;
+	}
+}
@@ -5,6 +5,7 @@
 #include <string.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 #ifdef DEBUG
 #define PULSE_DEBUG
@@ -33,3 +34,7 @@ void free_PulseDevice(PulseDevice *dev);
 typedef PulseDevice PulseOutputDevice;
 int init_PulseOutputDevice(PulseOutputDevice* dev, const int sample_rate, const int channels, const char* app_name, const char *stream_name, const char* device, pa_buffer_attr* buffer_attr, enum pa_sample_format format);
 int write_PulseOutputDevice(PulseOutputDevice *dev, void *buffer, size_t size);
+int latency_PulseOutputDevice(PulseOutputDevice *dev, pa_usec_t *latency);
+
+// The Pulse format of what encode_samples writes for a SAMPLE_*, native endian except for the packed S24
+enum pa_sample_format pulse_sample_format(uint8_t format);
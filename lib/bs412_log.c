@@ -0,0 +1,205 @@
+#include "bs412_log.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define HEADER_SIZE 4096 // keeps the records page aligned
+
+static int map_log(Bs412LogFile* log, int fd, size_t size, bool writable) {
+	void* map = mmap(NULL, size, writable ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) return -1;
+	log->header = map;
+	log->records = (Bs412LogRecord*)((uint8_t*)map + HEADER_SIZE);
+	log->size = size;
+	return 0;
+}
+
+static bool header_valid(const Bs412LogHeader* h, size_t file_size) {
+	return h->magic == BS412_LOG_MAGIC && h->version == BS412_LOG_VERSION && h->record_size == sizeof(Bs412LogRecord) && h->capacity != 0 && file_size >= HEADER_SIZE + h->capacity * sizeof(Bs412LogRecord);
+}
+
+// Carries on with an existing log if it has the same shape, otherwise starts it over
+int open_bs412_log(Bs412LogFile* log, const char* path, uint64_t capacity, uint32_t resolution) {
+	memset(log, 0, sizeof(Bs412LogFile));
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if(fd < 0) {
+		fprintf(stderr, "Could not open the BS412 log %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+
+	size_t size = HEADER_SIZE + capacity * sizeof(Bs412LogRecord);
+	struct stat st = {0};
+	bool keep = false;
+	if(fstat(fd, &st) == 0 && (size_t)st.st_size == size && map_log(log, fd, size, true) == 0) {
+		keep = header_valid(log->header, size) && log->header->capacity == capacity && log->header->resolution == resolution;
+		if(!keep) {
+			munmap(log->header, size);
+			log->header = NULL;
+		}
+	}
+
+	if(!keep) {
+		if(st.st_size != 0) fprintf(stderr, "The BS412 log %s has another layout, starting it over\n", path);
+		// Allocating the blocks now means the stores into the mapping can never hit a full disk
+		int err = 0;
+		if(ftruncate(fd, 0) != 0 || ftruncate(fd, size) != 0) err = errno;
+		else err = posix_fallocate(fd, 0, size);
+		if(err == 0 && map_log(log, fd, size, true) != 0) err = errno;
+		if(err != 0) {
+			fprintf(stderr, "Could not set up the BS412 log %s: %s\n", path, strerror(err));
+			close(fd);
+			return -1;
+		}
+		log->header->record_size = sizeof(Bs412LogRecord);
+		log->header->resolution = resolution;
+		log->header->capacity = capacity;
+		log->header->version = BS412_LOG_VERSION;
+		atomic_store(&log->header->head, 0);
+		log->header->magic = BS412_LOG_MAGIC;
+	}
+	close(fd);
+	return 0;
+}
+
+int open_bs412_log_readonly(Bs412LogFile* log, const char* path) {
+	memset(log, 0, sizeof(Bs412LogFile));
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		fprintf(stderr, "Could not open %s: %s\n", path, strerror(errno));
+		return -1;
+	}
+	struct stat st;
+	if(fstat(fd, &st) != 0 || (size_t)st.st_size < HEADER_SIZE || map_log(log, fd, st.st_size, false) != 0) {
+		fprintf(stderr, "Could not map %s\n", path);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+	if(!header_valid(log->header, log->size)) {
+		fprintf(stderr, "%s is not a BS412 log\n", path);
+		close_bs412_log(log);
+		return -1;
+	}
+	return 0;
+}
+
+void close_bs412_log(Bs412LogFile* log) {
+	if(log->header == NULL) return;
+	munmap(log->header, log->size);
+	log->header = NULL;
+}
+
+static inline float to_dbr(double power) {
+	return (power < 1e-12) ? -100.0f : 10.0f * log10f(power);
+}
+
+static void* bs412_logger_thread(void* arg) {
+	Bs412Logger* logger = arg;
+	Bs412LogHeader* header = logger->file.header;
+
+	double window[BS412_LOG_WINDOW] = {0};
+	uint32_t window_fill = 0, window_pos = 0;
+
+	double second_power = 0.0;
+	uint32_t second_samples = 0;
+	float second_gain = 0.0f;
+	uint32_t second_blocks = 0;
+
+	double interval_power = 0.0, interval_gain = 0.0;
+	float interval_window_max = -INFINITY, interval_gain_min = INFINITY;
+	uint32_t interval_seconds = 0;
+
+	struct timespec nap = { 0, 250000000 };
+	while(logger->running) {
+		size_t tail = atomic_load_explicit(&logger->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&logger->head, memory_order_acquire);
+		if(head == tail) {
+			nanosleep(&nap, NULL);
+			continue;
+		}
+
+		for(; tail != head; tail++) {
+			const Bs412LogBlock* block = &logger->blocks[tail % BS412_LOG_BLOCKS];
+			second_power += block->power_sum;
+			second_samples += block->samples;
+			second_gain += block->gain;
+			second_blocks++;
+			if(second_samples < logger->sample_rate) continue;
+
+			// A second is done, BS412 wants the mean power over the last 60 of them
+			double power = second_power / second_samples;
+			window[window_pos] = power;
+			window_pos = (window_pos + 1) % BS412_LOG_WINDOW;
+			if(window_fill < BS412_LOG_WINDOW) window_fill++;
+			double window_sum = 0.0;
+			for(uint32_t i = 0; i < window_fill; i++) window_sum += window[i];
+			float window_power = to_dbr(window_sum / window_fill);
+
+			float gain = second_gain / second_blocks;
+			interval_power += power;
+			interval_gain += gain;
+			if(window_power > interval_window_max) interval_window_max = window_power;
+			if(gain < interval_gain_min) interval_gain_min = gain;
+			interval_seconds++;
+			second_power = 0.0;
+			second_samples = 0;
+			second_gain = 0.0f;
+			second_blocks = 0;
+
+			if(interval_seconds < header->resolution) continue;
+
+			// Plain stores into the mapping, the kernel writes them back on its own
+			uint64_t n = atomic_load_explicit(&header->head, memory_order_relaxed);
+			Bs412LogRecord* record = &logger->file.records[n % header->capacity];
+			record->time = time(NULL);
+			record->mpx_power = to_dbr(interval_power / interval_seconds);
+			record->window_power = window_power;
+			record->window_max = interval_window_max;
+			record->gain_mean = interval_gain / interval_seconds;
+			record->gain_min = interval_gain_min;
+			record->flags = (window_fill < BS412_LOG_WINDOW) ? BS412_LOG_PARTIAL_WINDOW : 0;
+			atomic_store_explicit(&header->head, n + 1, memory_order_release);
+
+			interval_power = interval_gain = 0.0;
+			interval_window_max = -INFINITY;
+			interval_gain_min = INFINITY;
+			interval_seconds = 0;
+		}
+		atomic_store_explicit(&logger->tail, tail, memory_order_release);
+	}
+	return NULL;
+}
+
+// Keeps days worth of records at resolution seconds each
+int init_bs412_logger(Bs412Logger* logger, const char* path, uint32_t resolution, uint32_t days, uint32_t sample_rate) {
+	memset(logger, 0, sizeof(Bs412Logger));
+	if(resolution == 0) resolution = 1;
+	if(days == 0) days = 1;
+	uint64_t capacity = (uint64_t)days * 86400 / resolution;
+	if(open_bs412_log(&logger->file, path, capacity, resolution) != 0) return -1;
+
+	logger->sample_rate = sample_rate;
+	logger->running = true;
+	if(pthread_create(&logger->thread, NULL, bs412_logger_thread, logger) != 0) {
+		logger->running = false;
+		close_bs412_log(&logger->file);
+		return -1;
+	}
+	return 0;
+}
+
+void exit_bs412_logger(Bs412Logger* logger) {
+	if(!logger->running) return;
+	logger->running = false;
+	pthread_join(logger->thread, NULL);
+	if(logger->dropped) fprintf(stderr, "The BS412 logger missed %lu blocks\n", (unsigned long)logger->dropped);
+	msync(logger->file.header, logger->file.size, MS_SYNC);
+	close_bs412_log(&logger->file);
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define BS412_LOG_MAGIC 0x474c3442u // "B4LG"
+#define BS412_LOG_VERSION 1
+#define BS412_LOG_WINDOW 60 // seconds, the BS412 integration time
+#define BS412_LOG_BLOCKS 64
+
+#define BS412_LOG_PARTIAL_WINDOW 1 // less than a full window since fm95 started
+
+// One interval, the powers are in dBr like the rest of fm95
+typedef struct {
+	int64_t time; // unix seconds at the end of the interval
+	float mpx_power; // mean over the interval
+	float window_power; // 60 second value at the end of the interval
+	float window_max; // highest 60 second value within the interval
+	float gain_mean; // BS412 gain
+	float gain_min;
+	uint32_t flags;
+} Bs412LogRecord;
+
+// The file is this header followed by capacity records, written in a circle
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t record_size;
+	uint32_t resolution; // seconds per record
+	uint64_t capacity; // records
+	_Alignas(64) _Atomic uint64_t head; // records ever written, the newest is at (head - 1) % capacity
+} Bs412LogHeader;
+
+typedef struct {
+	Bs412LogHeader* header;
+	Bs412LogRecord* records;
+	size_t size;
+} Bs412LogFile;
+
+int open_bs412_log(Bs412LogFile* log, const char* path, uint64_t capacity, uint32_t resolution);
+int open_bs412_log_readonly(Bs412LogFile* log, const char* path);
+void close_bs412_log(Bs412LogFile* log);
+
+// What the DSP thread hands over per block, power is the sum of the squared composite over the reference
+typedef struct {
+	double power_sum;
+	uint32_t samples;
+	float gain; // at the end of the block
+} Bs412LogBlock;
+
+typedef struct {
+	Bs412LogFile file;
+	pthread_t thread;
+	volatile bool running;
+	uint32_t sample_rate;
+
+	Bs412LogBlock blocks[BS412_LOG_BLOCKS];
+	_Alignas(64) atomic_size_t head;
+	_Alignas(64) atomic_size_t tail;
+	uint64_t dropped; // only the DSP thread writes it
+} Bs412Logger;
+
+int init_bs412_logger(Bs412Logger* logger, const char* path, uint32_t resolution, uint32_t days, uint32_t sample_rate);
+void exit_bs412_logger(Bs412Logger* logger);
+
+// Called by the DSP thread once per block, never blocks
+static inline void log_bs412_block(Bs412Logger* logger, const Bs412LogBlock* block) {
+	size_t head = atomic_load_explicit(&logger->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&logger->tail, memory_order_acquire);
+	if(head - tail >= BS412_LOG_BLOCKS) {
+		logger->dropped++;
+		return;
+	}
+	logger->blocks[head % BS412_LOG_BLOCKS] = *block;
+	atomic_store_explicit(&logger->head, head + 1, memory_order_release);
+}
@@ -0,0 +1,210 @@
+#include "clip.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <liquid/liquid.h>
+
+#define WAVE_FORMAT_PCM 1
+#define WAVE_FORMAT_IEEE_FLOAT 3
+#define WAVE_FORMAT_EXTENSIBLE 0xfffe
+
+static uint16_t read_le16(const uint8_t* p) { return p[0] | (p[1] << 8); }
+static uint32_t read_le32(const uint8_t* p) { return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24); }
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+	const uint8_t* p = data;
+	for(size_t i = 0; i < size; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static float decode_sample(const uint8_t* p, uint16_t format, uint16_t bits) {
+	if(format == WAVE_FORMAT_IEEE_FLOAT) {
+		float f;
+		memcpy(&f, p, sizeof(f));
+		return f;
+	}
+	switch(bits) {
+		case 8: return (p[0] - 128) / 128.0f;
+		case 16: return (int16_t)read_le16(p) / 32768.0f;
+		case 24: return (int32_t)(((uint32_t)p[0] << 8) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 24)) / 2147483648.0f;
+		case 32: return (int32_t)read_le32(p) / 2147483648.0f;
+	}
+	return 0.0f;
+}
+
+// Decodes a WAV into mono float at its own rate
+static float* decode_wav(const char* path, size_t* length, uint32_t* rate) {
+	FILE* f = fopen(path, "rb");
+	if(f == NULL) {
+		perror(path);
+		return NULL;
+	}
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	uint8_t* file = malloc(size > 0 ? size : 1);
+	if(file == NULL || size < 12 || fread(file, 1, size, f) != (size_t)size || memcmp(file, "RIFF", 4) != 0 || memcmp(file + 8, "WAVE", 4) != 0) {
+		fprintf(stderr, "%s: not a WAV file\n", path);
+		fclose(f);
+		free(file);
+		return NULL;
+	}
+	fclose(f);
+
+	uint16_t format = 0, channels = 0, bits = 0;
+	const uint8_t* data = NULL;
+	uint32_t data_size = 0;
+	for(long pos = 12; pos + 8 <= size;) {
+		uint32_t chunk_size = read_le32(file + pos + 4);
+		const uint8_t* chunk = file + pos + 8;
+		if(chunk_size > (uint32_t)(size - pos - 8)) chunk_size = size - pos - 8;
+		if(memcmp(file + pos, "fmt ", 4) == 0 && chunk_size >= 16) {
+			format = read_le16(chunk);
+			channels = read_le16(chunk + 2);
+			*rate = read_le32(chunk + 4);
+			bits = read_le16(chunk + 14);
+			if(format == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 26) format = read_le16(chunk + 24);
+		} else if(memcmp(file + pos, "data", 4) == 0) {
+			data = chunk;
+			data_size = chunk_size;
+		}
+		pos += 8 + chunk_size + (chunk_size & 1);
+	}
+
+	bool supported = (format == WAVE_FORMAT_PCM && (bits == 8 || bits == 16 || bits == 24 || bits == 32)) || (format == WAVE_FORMAT_IEEE_FLOAT && bits == 32);
+	if(data == NULL || channels == 0 || *rate == 0 || !supported) {
+		fprintf(stderr, "%s: unsupported WAV format\n", path);
+		free(file);
+		return NULL;
+	}
+
+	size_t frame = channels * (bits / 8);
+	*length = data_size / frame;
+	float* out = malloc((*length ? *length : 1) * sizeof(float));
+	if(out != NULL) {
+		for(size_t i = 0; i < *length; i++) {
+			float sum = 0.0f;
+			for(uint16_t c = 0; c < channels; c++) sum += decode_sample(data + i * frame + c * (bits / 8), format, bits);
+			out[i] = sum / channels;
+		}
+	}
+	free(file);
+	return out;
+}
+
+static int convert_clip(const char* path, const char* cache_path, uint32_t sample_rate, float volume) {
+	size_t length;
+	uint32_t rate;
+	float* decoded = decode_wav(path, &length, &rate);
+	if(decoded == NULL) return -1;
+
+	float* out = decoded;
+	size_t out_length = length;
+	if(rate != sample_rate) {
+		float ratio = (float)sample_rate / rate;
+		resamp_rrrf resampler = resamp_rrrf_create_default(ratio);
+		out = malloc(((size_t)(length * ratio) + 64) * sizeof(float));
+		if(resampler == NULL || out == NULL) {
+			if(resampler) resamp_rrrf_destroy(resampler);
+			free(out);
+			free(decoded);
+			return -1;
+		}
+		unsigned int n;
+		out_length = 0;
+		for(size_t i = 0; i < length; i++) {
+			resamp_rrrf_execute(resampler, decoded[i], out + out_length, &n);
+			out_length += n;
+		}
+		resamp_rrrf_destroy(resampler);
+		free(decoded);
+	}
+	for(size_t i = 0; i < out_length; i++) out[i] *= volume;
+
+	// Written beside and renamed, so a half written cache is never mapped
+	char tmp_path[512];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+	FILE* f = fopen(tmp_path, "wb");
+	if(f == NULL) {
+		perror(tmp_path);
+		free(out);
+		return -1;
+	}
+	size_t written = fwrite(out, sizeof(float), out_length, f);
+	free(out);
+	if(fclose(f) != 0 || written != out_length || rename(tmp_path, cache_path) != 0) {
+		perror(cache_path);
+		unlink(tmp_path);
+		return -1;
+	}
+	return 0;
+}
+
+int load_clip(Clip* clip, const char* path, const char* cache_dir, uint32_t sample_rate, float volume) {
+	memset(clip, 0, sizeof(Clip));
+
+	struct stat st;
+	if(stat(path, &st) != 0) {
+		perror(path);
+		return -1;
+	}
+
+	// The cache name covers everything that goes into the conversion, a changed source gets converted again
+	uint64_t hash = 0xcbf29ce484222325ULL;
+	hash = fnv1a(hash, path, strlen(path));
+	hash = fnv1a(hash, &st.st_mtime, sizeof(st.st_mtime));
+	hash = fnv1a(hash, &st.st_size, sizeof(st.st_size));
+	hash = fnv1a(hash, &sample_rate, sizeof(sample_rate));
+	hash = fnv1a(hash, &volume, sizeof(volume));
+
+	char cache_path[512];
+	snprintf(cache_path, sizeof(cache_path), "%s/%016llx.f32", cache_dir, (unsigned long long)hash);
+
+	if(access(cache_path, R_OK) != 0) {
+		printf("Converting %s into %s\n", path, cache_path);
+		mkdir(cache_dir, 0755);
+		if(convert_clip(path, cache_path, sample_rate, volume) != 0) return -1;
+	}
+
+	int fd = open(cache_path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0 || fstat(fd, &st) != 0) {
+		perror(cache_path);
+		if(fd >= 0) close(fd);
+		return -1;
+	}
+	if(st.st_size < (off_t)sizeof(float)) {
+		fprintf(stderr, "%s: empty clip\n", cache_path);
+		close(fd);
+		return -1;
+	}
+
+	void* map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if(map == MAP_FAILED) {
+		perror("mmap");
+		return -1;
+	}
+
+	clip->samples = map;
+	clip->length = st.st_size / sizeof(float);
+	clip->map_size = st.st_size;
+	return 0;
+}
+
+void prefetch_clip(const Clip* clip) {
+	if(clip->samples != NULL) madvise((void*)clip->samples, clip->map_size, MADV_WILLNEED);
+}
+
+void unload_clip(Clip* clip) {
+	if(clip->samples != NULL) munmap((void*)clip->samples, clip->map_size);
+	clip->samples = NULL;
+}
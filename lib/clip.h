@@ -0,0 +1,15 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+// A pre-rendered clip, float32 mono at the output rate, mapped straight from the cache file
+typedef struct {
+	const float* samples;
+	size_t length;
+	size_t map_size;
+} Clip;
+
+int load_clip(Clip* clip, const char* path, const char* cache_dir, uint32_t sample_rate, float volume);
+void prefetch_clip(const Clip* clip);
+void unload_clip(Clip* clip);
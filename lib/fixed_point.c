@@ -0,0 +1,62 @@
+#include "fixed_point.h"
+#include "simd.h"
+#include <math.h>
+#include <pthread.h>
+
+int init_biquad_cascade(BiquadCascade* bq, const float* b, const float* a, unsigned int sections) {
+	if(sections > BIQUAD_MAX_SECTIONS) return -1;
+	memset(bq, 0, sizeof(BiquadCascade));
+	for(unsigned int i = 0; i < sections; i++) {
+		const float* bs = b + 3 * i;
+		const float* as = a + 3 * i;
+		float norm = 1.0f / as[0];
+		float coefs[5] = { bs[0] * norm, bs[1] * norm, bs[2] * norm, as[1] * norm, as[2] * norm };
+		for(int j = 0; j < 5; j++) {
+			if(fabsf(coefs[j]) >= 2.0f) return -1;
+		}
+		BiquadSection* s = &bq->sections[i];
+		s->b0 = coef_from_float(coefs[0], FIX_COEF_BITS);
+		s->b1 = coef_from_float(coefs[1], FIX_COEF_BITS);
+		s->b2 = coef_from_float(coefs[2], FIX_COEF_BITS);
+		s->a1 = coef_from_float(coefs[3], FIX_COEF_BITS);
+		s->a2 = coef_from_float(coefs[4], FIX_COEF_BITS);
+	}
+	bq->count = sections;
+	return 0;
+}
+
+void init_preemphasis_fix(PreemphasisFix* p, float alpha, float gain) {
+	p->alpha = coef_from_float(alpha, FIX_COEF_BITS);
+	p->gain = coef_from_float(gain, FIX_DRIVE_BITS);
+	p->prev = 0;
+}
+
+int32_t softclip_table[(1 << SOFTCLIP_TABLE_BITS) + 1];
+static pthread_once_t softclip_once = PTHREAD_ONCE_INIT;
+
+static void fill_softclip_table(void) {
+	for(uint32_t i = 0; i <= (1u << SOFTCLIP_TABLE_BITS); i++) {
+		double x = (double)i * SOFTCLIP_RANGE / (1 << SOFTCLIP_TABLE_BITS);
+		softclip_table[i] = (int32_t)lrint(tanh(x) * 2147483647.0);
+	}
+}
+
+void init_softclip_table(void) {
+	pthread_once(&softclip_once, fill_softclip_table);
+}
+
+// Clamping before the conversion is what makes this saturate
+void float_to_fix_block(const float* in, fix_t* out, size_t count, float gain) {
+	size_t i = 0;
+	v4sf scale = v4sf_set1(gain * FIX_ONE);
+	v4sf hi = v4sf_set1(FIX_MAX_FLOAT * FIX_ONE), lo = -hi;
+	for(; i + 4 <= count; i += 4) v4si_store(out + i, v4sf_to_v4si(v4sf_clamp(v4sf_load(in + i) * scale, lo, hi)));
+	for(; i < count; i++) out[i] = fix_from_float(in[i] * gain);
+}
+
+void q31_to_float_block(const int32_t* in, float* out, size_t count) {
+	size_t i = 0;
+	v4sf scale = v4sf_set1(1.0f / 2147483648.0f);
+	for(; i + 4 <= count; i += 4) v4sf_store(out + i, v4si_to_v4sf(v4si_load(in + i)) * scale);
+	for(; i < count; i++) out[i] = in[i] * (1.0f / 2147483648.0f);
+}
@@ -0,0 +1,113 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include "sine_lut.h"
+
+// Signals are int32 with 27 fractional bits, 1.0 is full scale and the 4 bits above leave room for filter overshoot and drive
+#define FIX_SIGNAL_BITS 27
+#define FIX_ONE (1 << FIX_SIGNAL_BITS)
+#define FIX_MAX_FLOAT 15.999f
+#define FIX_COEF_BITS 30 // biquad coefficients, ±2
+#define FIX_GAIN_BITS 28 // AGC gain and master volume, ±8
+#define FIX_DRIVE_BITS 24 // drive, makeup and preemphasis gain, ±128
+#define FIX_MIX_BITS 15 // mixing volumes, Q15
+
+#define BIQUAD_MAX_SECTIONS 10
+
+#define SOFTCLIP_TABLE_BITS 12
+#define SOFTCLIP_RANGE 8 // tanh is flat past this, in full scales
+#define SOFTCLIP_STEP_BITS (FIX_SIGNAL_BITS + 3 - SOFTCLIP_TABLE_BITS) // 3 being log2 of the range
+
+typedef int32_t fix_t;
+typedef int16_t q15_t;
+
+static inline int32_t sat_q31(int64_t x) {
+	if(x > INT32_MAX) return INT32_MAX;
+	if(x < INT32_MIN) return INT32_MIN;
+	return (int32_t)x;
+}
+
+static inline fix_t fix_from_float(float x) {
+	if(x > FIX_MAX_FLOAT) x = FIX_MAX_FLOAT;
+	if(x < -FIX_MAX_FLOAT) x = -FIX_MAX_FLOAT;
+	return (fix_t)(x * FIX_ONE);
+}
+static inline float fix_to_float(fix_t x) { return x * (1.0f / FIX_ONE); }
+
+static inline q15_t q15_from_float(float x) {
+	if(x >= 32767.0f / 32768.0f) return INT16_MAX;
+	if(x <= -1.0f) return INT16_MIN;
+	return (q15_t)lrintf(x * 32768.0f);
+}
+// For coefficients and gains, in whatever Q the bits say
+static inline int32_t coef_from_float(float x, int bits) { return sat_q31(llrintf(x * (float)(1ll << bits))); }
+
+static inline fix_t fix_mul(fix_t x, int32_t c, int bits) { return sat_q31(((int64_t)x * c) >> bits); }
+static inline fix_t fix_mul_q15(fix_t x, q15_t g) { return (fix_t)(((int64_t)x * g) >> FIX_MIX_BITS); }
+static inline fix_t fix_mul_q31(fix_t x, int32_t q31) { return (fix_t)(((int64_t)x * q31) >> 31); }
+
+// Butterworth, Chebyshev... in second order sections, direct form I with the rounding error fed back into the next sample
+typedef struct {
+	int32_t b0, b1, b2, a1, a2;
+	fix_t x1, x2, y1, y2;
+	int64_t residue;
+} BiquadSection;
+
+typedef struct {
+	BiquadSection sections[BIQUAD_MAX_SECTIONS];
+	uint8_t count;
+} BiquadCascade;
+
+// b and a are 3 per section as liquid_iirdes gives them, fails when a coefficient does not fit Q30
+int init_biquad_cascade(BiquadCascade* bq, const float* b, const float* a, unsigned int sections);
+
+static inline fix_t process_biquad_cascade(BiquadCascade* bq, fix_t x) {
+	for(uint8_t i = 0; i < bq->count; i++) {
+		BiquadSection* s = &bq->sections[i];
+		int64_t acc = s->residue + (int64_t)s->b0 * x + (int64_t)s->b1 * s->x1 + (int64_t)s->b2 * s->x2 - (int64_t)s->a1 * s->y1 - (int64_t)s->a2 * s->y2;
+		fix_t y = sat_q31(acc >> FIX_COEF_BITS);
+		s->residue = acc & ((1ll << FIX_COEF_BITS) - 1);
+		s->x2 = s->x1;
+		s->x1 = x;
+		s->y2 = s->y1;
+		s->y1 = y;
+		x = y;
+	}
+	return x;
+}
+
+// The one pole preemphasis of filter/iir.h
+typedef struct {
+	int32_t alpha; // Q30
+	int32_t gain; // Q24
+	fix_t prev;
+} PreemphasisFix;
+
+void init_preemphasis_fix(PreemphasisFix* p, float alpha, float gain);
+
+static inline fix_t apply_preemphasis_fix(PreemphasisFix* p, fix_t x) {
+	fix_t diff = sat_q31((int64_t)x - (((int64_t)p->alpha * p->prev) >> FIX_COEF_BITS));
+	p->prev = x;
+	return fix_mul(diff, p->gain, FIX_DRIVE_BITS);
+}
+
+extern int32_t softclip_table[(1 << SOFTCLIP_TABLE_BITS) + 1];
+void init_softclip_table(void);
+
+// tanh from a table, in Q31
+static inline int32_t softclip_q31(fix_t x) {
+	uint32_t ax = (x < 0) ? (uint32_t)0 - (uint32_t)x : (uint32_t)x;
+	if(ax >= (uint32_t)SOFTCLIP_RANGE << FIX_SIGNAL_BITS) return (x < 0) ? -softclip_table[1 << SOFTCLIP_TABLE_BITS] : softclip_table[1 << SOFTCLIP_TABLE_BITS];
+	uint32_t idx = ax >> SOFTCLIP_STEP_BITS;
+	int64_t frac = ax & ((1u << SOFTCLIP_STEP_BITS) - 1);
+	int32_t a = softclip_table[idx];
+	int32_t y = a + (int32_t)(((int64_t)(softclip_table[idx + 1] - a) * frac) >> SOFTCLIP_STEP_BITS);
+	return (x < 0) ? -y : y;
+}
+
+void float_to_fix_block(const float* in, fix_t* out, size_t count, float gain);
+void q31_to_float_block(const int32_t* in, float* out, size_t count);
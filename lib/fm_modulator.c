@@ -0,0 +1,112 @@
+#include "fm_modulator.h"
+#include "simd.h"
+
+#define FM_CHUNK 256 // Must stay a multiple of 4
+
+void init_fm_modulator(FMModulator *fm, float frequency, float deviation, float sample_rate) {
+	init_sine_lut();
+	fm->phase = 0;
+	fm->carrier_increment = frequency_to_phase_increment(frequency, sample_rate);
+	fm->deviation_scale = (float)((double)deviation / sample_rate * 4294967296.0);
+	fm->max_deviation = 2147483520.0f; // Largest float below 2^31, anything over half the sample rate is aliased anyway
+}
+
+float modulate_fm(FMModulator *fm, float sample) {
+	float deviation = hard_clip(sample * fm->deviation_scale, fm->max_deviation);
+	fm->phase += fm->carrier_increment + (uint32_t)(int32_t)deviation;
+	return sine_lut(fm->phase);
+}
+
+static void modulate_phases(FMModulator *fm, const float *input, uint32_t *phases, size_t n, float input_volume, float clipper) {
+	int32_t deviation[FM_CHUNK];
+
+	const v4sf v_volume = v4sf_set1(input_volume);
+	const v4sf v_clip = v4sf_set1(clipper);
+	const v4sf v_scale = v4sf_set1(fm->deviation_scale);
+	const v4sf v_limit = v4sf_set1(fm->max_deviation);
+	const uint32_t carrier = fm->carrier_increment;
+	size_t vn = n & ~(size_t)3;
+
+	for(size_t i = 0; i < vn; i += 4) {
+		v4sf x = v4sf_clamp(v4sf_load(input + i) * v_volume, -v_clip, v_clip);
+		v4si_store(deviation + i, v4sf_to_v4si(v4sf_clamp(x * v_scale, -v_limit, v_limit)));
+	}
+	for(size_t i = vn; i < n; i++) deviation[i] = (int32_t)hard_clip(hard_clip(input[i] * input_volume, clipper) * fm->deviation_scale, fm->max_deviation);
+
+	// The accumulation is the only serial part, everything around it is done four samples at a time
+	uint32_t phase = fm->phase;
+	for(size_t i = 0; i < n; i++) {
+		phase += carrier + (uint32_t)deviation[i];
+		phases[i] = phase;
+	}
+	fm->phase = phase;
+}
+
+void modulate_fm_block(FMModulator *fm, const float *input, float *output, size_t count, float input_volume, float clipper, float output_volume) {
+	uint32_t phases[FM_CHUNK];
+	const v4sf v_out_volume = v4sf_set1(output_volume);
+
+	while(count > 0) {
+		size_t n = (count > FM_CHUNK) ? FM_CHUNK : count;
+		size_t vn = n & ~(size_t)3;
+
+		modulate_phases(fm, input, phases, n, input_volume, clipper);
+
+		for(size_t i = 0; i < n; i++) output[i] = sine_lut(phases[i]);
+		for(size_t i = 0; i < vn; i += 4) v4sf_store(output + i, v4sf_load(output + i) * v_out_volume);
+		for(size_t i = vn; i < n; i++) output[i] *= output_volume;
+
+		input += n;
+		output += n;
+		count -= n;
+	}
+}
+
+int init_fm_upconverter(FMUpconverter *up, float frequency, float deviation, uint32_t input_rate, uint32_t output_rate) {
+	if(input_rate == 0 || output_rate % input_rate != 0) return -1;
+
+	init_fm_modulator(&up->baseband, 0.0f, deviation, input_rate);
+	up->interpolation = output_rate / input_rate;
+	up->carrier_phase = 0;
+	up->carrier_increment = frequency_to_phase_increment(frequency, output_rate);
+
+	// The filter keeps the subcarrier within +-input_rate/2 of the carrier
+	up->interp = firinterp_crcf_create_kaiser(up->interpolation, 12, 70.0f);
+	if(up->interp == NULL) return -1;
+
+	// Measure the DC gain once and take it out, so that the injection level doesn't depend on the rates
+	float complex y[up->interpolation];
+	for(int i = 0; i < 64; i++) firinterp_crcf_execute(up->interp, 1.0f, y);
+	up->interp_gain = 1.0f / cabsf(y[0]);
+	firinterp_crcf_reset(up->interp);
+	return 0;
+}
+
+void upconvert_fm_block(FMUpconverter *up, const float *input, float *output, size_t count, float input_volume, float clipper, float output_volume) {
+	uint32_t phases[FM_CHUNK];
+	float complex y[up->interpolation];
+	const float gain = up->interp_gain * output_volume;
+
+	uint32_t carrier = up->carrier_phase;
+	while(count > 0) {
+		size_t n = (count > FM_CHUNK) ? FM_CHUNK : count;
+		modulate_phases(&up->baseband, input, phases, n, input_volume, clipper);
+
+		for(size_t i = 0; i < n; i++) {
+			firinterp_crcf_execute(up->interp, cosine_lut(phases[i]) + sine_lut(phases[i]) * I, y);
+			for(uint32_t j = 0; j < up->interpolation; j++) {
+				carrier += up->carrier_increment;
+				*output++ = (crealf(y[j]) * cosine_lut(carrier) - cimagf(y[j]) * sine_lut(carrier)) * gain;
+			}
+		}
+
+		input += n;
+		count -= n;
+	}
+	up->carrier_phase = carrier;
+}
+
+void exit_fm_upconverter(FMUpconverter *up) {
+	if(up->interp != NULL) firinterp_crcf_destroy(up->interp);
+	up->interp = NULL;
+}
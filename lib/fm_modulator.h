@@ -0,0 +1,35 @@
+#pragma once
+
+#include <math.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <complex.h>
+#include <liquid/liquid.h>
+#include "sine_lut.h"
+
+typedef struct {
+	uint32_t phase;
+	uint32_t carrier_increment;
+	float deviation_scale; // Phase increment per unit of input
+	float max_deviation;
+} FMModulator;
+
+// FM generated at complex baseband at the (low) input rate, then interpolated and moved up to the carrier
+typedef struct {
+	FMModulator baseband;
+	firinterp_crcf interp;
+	uint32_t interpolation;
+	float interp_gain;
+	uint32_t carrier_phase;
+	uint32_t carrier_increment;
+} FMUpconverter;
+
+static inline float hard_clip(float sample, float threshold) { return fmaxf(-threshold, fminf(threshold, sample)); }
+
+void init_fm_modulator(FMModulator *fm, float frequency, float deviation, float sample_rate);
+float modulate_fm(FMModulator *fm, float sample);
+void modulate_fm_block(FMModulator *fm, const float *input, float *output, size_t count, float input_volume, float clipper, float output_volume);
+
+int init_fm_upconverter(FMUpconverter *up, float frequency, float deviation, uint32_t input_rate, uint32_t output_rate);
+void upconvert_fm_block(FMUpconverter *up, const float *input, float *output, size_t count, float input_volume, float clipper, float output_volume);
+void exit_fm_upconverter(FMUpconverter *up);
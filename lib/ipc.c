@@ -1,13 +1,50 @@
+#define _GNU_SOURCE
 #include "ipc.h"
 
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <pthread.h>
 #include <sys/un.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+
+#define IPC_READ_CHUNK 65536
+#define IPC_MAX_EVENTS 16
+#define IPC_READS_PER_WAKEUP 16 /* keeps one busy client from starving the rest */
+
+typedef struct {
+    int fd;
+    uint8_t *in;          /* partial frames carried over between reads */
+    size_t in_len;
+    ipc_buffer_t out;     /* replies not yet taken by the socket */
+    int want_out;
+} ipc_client_t;
+
+static int reserve(ipc_buffer_t *buf, size_t extra) {
+    if (buf->len + extra <= buf->cap) return 0;
+    size_t cap = buf->cap ? buf->cap : 512;
+    while (cap < buf->len + extra) cap *= 2;
+    uint8_t *data = realloc(buf->data, cap);
+    if (!data) return -1;
+    buf->data = data;
+    buf->cap = cap;
+    return 0;
+}
+
+int ipc_reply(ipc_buffer_t *out, const void *payload, size_t len) {
+    if (len > IPC_MAX_FRAME) return -1;
+    if (reserve(out, len + 2) < 0) return -1;
+    out->data[out->len++] = len & 0xff;
+    out->data[out->len++] = len >> 8;
+    memcpy(out->data + out->len, payload, len);
+    out->len += len;
+    return 0;
+}
 
 static int make_server_socket(const char *path) {
-    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (fd < 0) { perror("ipc: socket"); return -1; }
 
     unlink(path);
@@ -24,71 +61,184 @@ static int make_server_socket(const char *path) {
     return fd;
 }
 
+static void drop_client(ipc_ctx_t *ctx, ipc_client_t *c) {
+    for (int i = 0; i < IPC_MAX_CLIENTS; i++)
+        if (ctx->_clients[i] == c) ctx->_clients[i] = NULL;
+    printf("[ipc] client fd=%d disconnected\n", c->fd);
+    epoll_ctl(ctx->epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    free(c->in);
+    free(c->out.data);
+    free(c);
+}
+
+static void accept_clients(ipc_ctx_t *ctx) {
+    while (1) {
+        int fd = accept4(ctx->server_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("ipc: accept");
+            return;
+        }
+        int slot = 0;
+        while (slot < IPC_MAX_CLIENTS && ctx->_clients[slot]) slot++;
+        if (slot == IPC_MAX_CLIENTS) {
+            fprintf(stderr, "[ipc] too many clients, refusing fd=%d\n", fd);
+            close(fd);
+            continue;
+        }
+
+        ipc_client_t *c = calloc(1, sizeof(ipc_client_t));
+        if (c) c->in = malloc(IPC_READ_CHUNK + IPC_MAX_FRAME + 2);
+        if (!c || !c->in) { free(c); close(fd); continue; }
+        c->fd = fd;
+
+        struct epoll_event ev = { .events = EPOLLIN | EPOLLRDHUP, .data.ptr = c };
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+            perror("ipc: epoll_ctl");
+            free(c->in); free(c); close(fd);
+            continue;
+        }
+        ctx->_clients[slot] = c;
+        printf("[ipc] new client fd=%d\n", fd);
+    }
+}
+
+/* Sends what the socket takes, and asks for EPOLLOUT while anything is left */
+static int flush_client(ipc_ctx_t *ctx, ipc_client_t *c) {
+    size_t sent = 0;
+    while (sent < c->out.len) {
+        ssize_t n = send(c->fd, c->out.data + sent, c->out.len - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        }
+        sent += n;
+    }
+    memmove(c->out.data, c->out.data + sent, c->out.len - sent);
+    c->out.len -= sent;
+    if (c->out.len > IPC_OUT_LIMIT) return -1;
+
+    int want_out = c->out.len != 0;
+    if (want_out != c->want_out) {
+        struct epoll_event ev = {
+            .events = EPOLLIN | EPOLLRDHUP | (want_out ? EPOLLOUT : 0),
+            .data.ptr = c
+        };
+        if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) < 0) return -1;
+        c->want_out = want_out;
+    }
+    return 0;
+}
+
+/* Reads everything pending, runs every complete frame, then flushes the replies once */
+static int service_client(ipc_ctx_t *ctx, ipc_client_t *c) {
+    int eof = 0;
+    for (int reads = 0; !eof && reads < IPC_READS_PER_WAKEUP; reads++) {
+        ssize_t n = recv(c->fd, c->in + c->in_len, IPC_READ_CHUNK, 0);
+        if (n == 0) eof = 1;
+        else if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return -1;
+        } else c->in_len += n;
+
+        size_t pos = 0;
+        while (c->in_len - pos >= 2) {
+            size_t len = c->in[pos] | (c->in[pos + 1] << 8);
+            if (c->in_len - pos - 2 < len) break;
+            if (len != 0) ctx->handler(c->in + pos + 2, len, &c->out, ctx->user_data);
+            pos += 2 + len;
+        }
+        memmove(c->in, c->in + pos, c->in_len - pos);
+        c->in_len -= pos;
+    }
+
+    if (flush_client(ctx, c) < 0) return -1;
+    return eof ? -1 : 0;
+}
+
 static void *listener_thread(void *arg) {
     ipc_ctx_t *ctx = (ipc_ctx_t *)arg;
+    struct epoll_event events[IPC_MAX_EVENTS];
 
     while (ctx->running) {
-        struct sockaddr_un peer;
-        socklen_t peer_len = sizeof(peer);
-
-        int client_fd = accept(ctx->server_fd,
-                               (struct sockaddr *)&peer, &peer_len);
-        if (client_fd < 0) {
-            if (errno == EINVAL || errno == EBADF) break; /* shutting down */
-            if (errno == EINTR)                   continue;
-            perror("ipc: accept");
-            continue;
+        int n = epoll_wait(ctx->epoll_fd, events, IPC_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("ipc: epoll_wait");
+            break;
         }
 
-        printf("[ipc] new client fd=%d\n", client_fd);
-
-        ipc_client_arg_t *carg = malloc(sizeof(ipc_client_arg_t));
-        if (!carg) { close(client_fd); continue; }
-        carg->client_fd = client_fd;
-        carg->user_data = ctx->user_data;
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &ctx->server_fd) { accept_clients(ctx); continue; }
+            if (ptr == &ctx->wake_fd) continue; /* destroy_ipc, running is already 0 */
 
-        pthread_t tid;
-        if (pthread_create(&tid, NULL,
-                           (void *(*)(void *))ctx->handler, carg) != 0) {
-            perror("ipc: pthread_create");
-            free(carg);
-            close(client_fd);
-            continue;
+            ipc_client_t *c = ptr;
+            int err = 0;
+            if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) err = service_client(ctx, c);
+            else if (events[i].events & EPOLLOUT) err = flush_client(ctx, c);
+            if (err < 0) drop_client(ctx, c);
         }
-        pthread_detach(tid);
     }
 
+    for (int i = 0; i < IPC_MAX_CLIENTS; i++)
+        if (ctx->_clients[i]) drop_client(ctx, ctx->_clients[i]);
+
     printf("[ipc] listener exiting\n");
     return NULL;
 }
 
-int create_ipc(ipc_ctx_t *ctx, ipc_client_fn handler, const char *socket_path, void *user_data) {
+int create_ipc(ipc_ctx_t *ctx, ipc_command_fn handler, const char *socket_path, void *user_data) {
     ctx->handler = handler;
     ctx->user_data = user_data;
     ctx->running = 1;
+    memset(ctx->_clients, 0, sizeof(ctx->_clients));
+    ctx->epoll_fd = -1;
+    ctx->wake_fd = -1;
     ctx->server_fd = make_server_socket(socket_path);
     ctx->socket_path = strdup(socket_path);
-    if (ctx->server_fd < 0) return -1;
+    if (ctx->server_fd < 0) goto fail;
+
+    ctx->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    ctx->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ctx->epoll_fd < 0 || ctx->wake_fd < 0) { perror("ipc: epoll"); goto fail; }
 
-    pthread_t tid;
-    if (pthread_create(&tid, NULL, listener_thread, ctx) != 0) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = &ctx->server_fd };
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->server_fd, &ev) < 0) { perror("ipc: epoll_ctl"); goto fail; }
+    ev.data.ptr = &ctx->wake_fd;
+    if (epoll_ctl(ctx->epoll_fd, EPOLL_CTL_ADD, ctx->wake_fd, &ev) < 0) { perror("ipc: epoll_ctl"); goto fail; }
+
+    if (pthread_create(&ctx->_tid, NULL, listener_thread, ctx) != 0) {
         perror("ipc: pthread_create");
-        close(ctx->server_fd);
-        unlink(socket_path);
-        return -1;
+        goto fail;
     }
 
-    ctx->_tid = tid;
-
     printf("[ipc] listening on %s\n", socket_path);
     return 0;
+
+fail:
+    if (ctx->wake_fd >= 0) close(ctx->wake_fd);
+    if (ctx->epoll_fd >= 0) close(ctx->epoll_fd);
+    if (ctx->server_fd >= 0) {
+        close(ctx->server_fd);
+        unlink(socket_path);
+    }
+    free(ctx->socket_path);
+    return -1;
 }
 
 void destroy_ipc(ipc_ctx_t *ctx) {
     ctx->running = 0;
-    shutdown(ctx->server_fd, SHUT_RDWR); /* unblock accept() */
+    uint64_t one = 1;
+    if (write(ctx->wake_fd, &one, sizeof(one)) < 0) perror("ipc: wake");
+    pthread_join(ctx->_tid, NULL);
+    close(ctx->epoll_fd);
+    close(ctx->wake_fd);
     close(ctx->server_fd);
     unlink(ctx->socket_path);
-    pthread_join(ctx->_tid, NULL);
+    free(ctx->socket_path);
     printf("[ipc] shut down\n");
-}
\ No newline at end of file
+}
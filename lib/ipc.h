@@ -1,29 +1,48 @@
 #pragma once
 
 #include <stdint.h>
+#include <stddef.h>
 #include <pthread.h>
 #include <sys/socket.h>
 #include <unistd.h>
 #include <stdio.h>
 
-#define IPC_BACKLOG 1
+#define IPC_BACKLOG 8
+#define IPC_MAX_CLIENTS 16
+#define IPC_MAX_FRAME 65535     /* payload limit of one u16 length-prefixed frame */
+#define IPC_OUT_LIMIT (1 << 20) /* a client that stops reading replies gets dropped here */
+
+/*
+ * Every command and every reply is a frame: a little-endian u16 payload
+ * length followed by the payload. A client may write any number of frames
+ * in one go; the replies to everything that arrived together go back in
+ * one send.
+ */
 
 typedef struct {
-    int  client_fd;
-    void *user_data;
-} ipc_client_arg_t;
+    uint8_t *data;
+    size_t len;
+    size_t cap;
+} ipc_buffer_t;
+
+/* Appends one reply frame to the batch going back to the client */
+int ipc_reply(ipc_buffer_t *out, const void *payload, size_t len);
 
-typedef void *(*ipc_client_fn)(ipc_client_arg_t *arg);
+typedef void (*ipc_command_fn)(const uint8_t *cmd, size_t len,
+                               ipc_buffer_t *out, void *user_data);
 
 typedef struct {
     int server_fd;
+    int epoll_fd;
+    int wake_fd;
     volatile int running;
-    ipc_client_fn handler;
+    ipc_command_fn handler;
     void *user_data;
     pthread_t _tid;       /* internal — do not touch */
+    void *_clients[IPC_MAX_CLIENTS];
     char *socket_path;
 } ipc_ctx_t;
 
-int  create_ipc(ipc_ctx_t *ctx, ipc_client_fn handler,
+int  create_ipc(ipc_ctx_t *ctx, ipc_command_fn handler,
                 const char *socket_path, void *user_data);
-void destroy_ipc(ipc_ctx_t *ctx);
\ No newline at end of file
+void destroy_ipc(ipc_ctx_t *ctx);
@@ -0,0 +1,200 @@
+#include "jitter_buffer.h"
+
+#include <string.h>
+#include <math.h>
+
+#define JITTER_RESYNC 1024 // a jump of more frames than this means that the sender restarted
+#define JITTER_FORMATS 5
+
+static const uint8_t bytes_per_sample[JITTER_FORMATS] = {1, 2, 3, 4, 4};
+
+static void fill_silence(uint8_t* out, size_t size, uint8_t format) {
+	memset(out, (format == 0) ? 128 : 0, size);
+}
+
+// The previous packet again, faded out across its length
+static void fade_out(uint8_t* out, const uint8_t* in, size_t size, uint8_t format) {
+	uint8_t bps = bytes_per_sample[format % JITTER_FORMATS];
+	size_t n = size / bps;
+	for(size_t i = 0; i < n; i++) {
+		float gain = 1.0f - (float)i / n;
+		const uint8_t* s = in + i * bps;
+		uint8_t* d = out + i * bps;
+		switch(format) {
+			case 0:
+				d[0] = (uint8_t)(128 + (s[0] - 128) * gain);
+				break;
+			case 1: {
+				int16_t v;
+				memcpy(&v, s, sizeof(v));
+				v = (int16_t)(v * gain);
+				memcpy(d, &v, sizeof(v));
+				break;
+			}
+			case 2: {
+				int32_t v = (int32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24)) >> 8;
+				v = (int32_t)(v * gain);
+				d[0] = v;
+				d[1] = v >> 8;
+				d[2] = v >> 16;
+				break;
+			}
+			case 3: {
+				int32_t v;
+				memcpy(&v, s, sizeof(v));
+				v = (int32_t)(v * (double)gain);
+				memcpy(d, &v, sizeof(v));
+				break;
+			}
+			default: {
+				float v;
+				memcpy(&v, s, sizeof(v));
+				v *= gain;
+				memcpy(d, &v, sizeof(v));
+				break;
+			}
+		}
+	}
+	fill_silence(out + n * bps, size - n * bps, format);
+}
+
+static size_t conceal(JitterBuffer* jb, uint8_t* out) {
+	if(jb->last_size == 0) return 0;
+	jb->concealed++;
+	if(jb->lost_run == 0) fade_out(out, jb->last, jb->last_size, jb->format);
+	else fill_silence(out, jb->last_size, jb->format);
+	if(jb->lost_run < UINT8_MAX) jb->lost_run++;
+	return jb->last_size;
+}
+
+void init_jitter_buffer(JitterBuffer* jb, uint8_t min_depth, uint8_t max_depth) {
+	memset(jb, 0, sizeof(JitterBuffer));
+	if(max_depth > JITTER_MAX_PACKETS) max_depth = JITTER_MAX_PACKETS;
+	if(min_depth < 1) min_depth = 1;
+	if(min_depth > max_depth) min_depth = max_depth;
+	jb->min_depth = min_depth;
+	jb->max_depth = max_depth;
+	jb->target_depth = min_depth;
+}
+
+void reset_jitter_buffer(JitterBuffer* jb, uint8_t format) {
+	for(int i = 0; i < JITTER_MAX_PACKETS; i++) jb->slots[i].valid = false;
+	jb->started = false;
+	jb->playing = false;
+	jb->format = format;
+	jb->last_size = 0;
+	jb->lost_run = 0;
+	jb->last_arrival = 0;
+}
+
+int push_jitter_buffer(JitterBuffer* jb, uint32_t frame_num, const void* data, size_t size, double arrival, double packet_duration) {
+	if(size > JITTER_MAX_PAYLOAD) size = JITTER_MAX_PAYLOAD;
+
+	int32_t ahead = (int32_t)(frame_num - jb->next_frame);
+	if(!jb->started || ahead > JITTER_RESYNC || ahead < -JITTER_RESYNC) {
+		for(int i = 0; i < JITTER_MAX_PACKETS; i++) jb->slots[i].valid = false;
+		jb->next_frame = jb->newest_frame = frame_num;
+		jb->started = true;
+		jb->playing = false;
+		jb->last_arrival = 0;
+		ahead = 0;
+	}
+	if(ahead < 0) {
+		jb->late++;
+		return JITTER_LATE;
+	}
+
+	// No room left for it, give up on the oldest frames
+	while(ahead >= jb->max_depth) {
+		JitterPacket* old = &jb->slots[jb->next_frame % JITTER_MAX_PACKETS];
+		if(old->valid && old->frame_num == jb->next_frame) {
+			old->valid = false;
+			jb->dropped++;
+		}
+		jb->next_frame++;
+		ahead--;
+	}
+
+	JitterPacket* slot = &jb->slots[frame_num % JITTER_MAX_PACKETS];
+	if(slot->valid && slot->frame_num == frame_num) {
+		jb->duplicate++;
+		return JITTER_DUPLICATE;
+	}
+	memcpy(slot->data, data, size);
+	slot->size = size;
+	slot->frame_num = frame_num;
+	slot->valid = true;
+	if((int32_t)(frame_num - jb->newest_frame) > 0) jb->newest_frame = frame_num;
+	jb->received++;
+
+	if(jb->last_arrival > 0) {
+		double d = (arrival - jb->last_arrival) - (int32_t)(frame_num - jb->last_frame) * packet_duration;
+		jb->jitter += (fabs(d) - jb->jitter) / 16.0;
+	}
+	jb->last_arrival = arrival;
+	jb->last_frame = frame_num;
+
+	// Enough depth to ride out three times the mean deviation
+	double target = jb->min_depth + ceil(3.0 * jb->jitter / packet_duration);
+	jb->target_depth = (target > jb->max_depth) ? jb->max_depth : (uint8_t)target;
+
+	return JITTER_OK;
+}
+
+size_t pop_jitter_buffer(JitterBuffer* jb, void* out) {
+	if(!jb->started) return 0;
+
+	uint8_t fill = jitter_buffer_fill(jb);
+	if(!jb->playing) {
+		// Keep the output going while we rebuffer, this is what grows the delay
+		if(fill < jb->target_depth) return conceal(jb, out);
+		jb->playing = true;
+	}
+	if(fill == 0) {
+		jb->playing = false;
+		return conceal(jb, out);
+	}
+
+	// Too deep after a burst, catch up a frame at a time
+	uint8_t margin = jb->rate_controlled ? jb->target_depth / 2 + 1 : 1;
+	if(fill > jb->target_depth + margin) {
+		JitterPacket* skip = &jb->slots[jb->next_frame % JITTER_MAX_PACKETS];
+		if(skip->valid && skip->frame_num == jb->next_frame) {
+			skip->valid = false;
+			jb->dropped++;
+		}
+		jb->next_frame++;
+	}
+
+	JitterPacket* slot = &jb->slots[jb->next_frame % JITTER_MAX_PACKETS];
+	if(!slot->valid || slot->frame_num != jb->next_frame) {
+		// Shallower than the target, it may still come so wait for it
+		if(fill < jb->target_depth) {
+			jb->playing = false;
+			return conceal(jb, out);
+		}
+		jb->next_frame++;
+		return conceal(jb, out);
+	}
+
+	jb->next_frame++;
+	slot->valid = false;
+	memcpy(out, slot->data, slot->size);
+	memcpy(jb->last, slot->data, slot->size);
+	jb->last_size = slot->size;
+	jb->lost_run = 0;
+	return slot->size;
+}
+
+uint8_t jitter_buffer_fill(const JitterBuffer* jb) {
+	if(!jb->started) return 0;
+	int32_t fill = (int32_t)(jb->newest_frame - jb->next_frame) + 1;
+	if(fill <= 0) return 0;
+	return (fill > UINT8_MAX) ? UINT8_MAX : (uint8_t)fill;
+}
+
+bool jitter_buffer_ready(const JitterBuffer* jb) {
+	if(!jb->started || !jb->playing) return false;
+	const JitterPacket* slot = &jb->slots[jb->next_frame % JITTER_MAX_PACKETS];
+	return slot->valid && slot->frame_num == jb->next_frame;
+}
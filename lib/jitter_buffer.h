@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+#define JITTER_MAX_PACKETS 128 // fm95 pulls a whole block of packets at once
+#define JITTER_MAX_PAYLOAD 1472 // biggest VBAN payload in an ethernet frame
+
+#define JITTER_OK 0
+#define JITTER_LATE 1
+#define JITTER_DUPLICATE 2
+
+typedef struct {
+	uint8_t data[JITTER_MAX_PAYLOAD];
+	size_t size;
+	uint32_t frame_num;
+	bool valid;
+} JitterPacket;
+
+// Reorders packets by frame number and hands them out at the consumer's pace, the caller does the locking
+typedef struct {
+	JitterPacket slots[JITTER_MAX_PACKETS];
+	uint32_t next_frame; // the frame the next pop plays
+	uint32_t newest_frame;
+	bool started;
+	bool playing; // false while (re)buffering up to the target
+
+	uint8_t format; // VBAN format index of the payloads, needed to fade
+	uint8_t last[JITTER_MAX_PAYLOAD];
+	size_t last_size;
+	uint8_t lost_run;
+
+	// Interarrival jitter as in RFC 3550, in seconds
+	double jitter;
+	double last_arrival;
+	uint32_t last_frame;
+
+	uint8_t min_depth;
+	uint8_t max_depth;
+	uint8_t target_depth;
+	bool rate_controlled; // set after init when the consumer follows the depth itself, frames are then only skipped well above the target
+
+	uint32_t received;
+	uint32_t late;
+	uint32_t duplicate;
+	uint32_t concealed;
+	uint32_t dropped;
+} JitterBuffer;
+
+void init_jitter_buffer(JitterBuffer* jb, uint8_t min_depth, uint8_t max_depth);
+void reset_jitter_buffer(JitterBuffer* jb, uint8_t format);
+int push_jitter_buffer(JitterBuffer* jb, uint32_t frame_num, const void* data, size_t size, double arrival, double packet_duration);
+size_t pop_jitter_buffer(JitterBuffer* jb, void* out);
+uint8_t jitter_buffer_fill(const JitterBuffer* jb);
+bool jitter_buffer_ready(const JitterBuffer* jb);
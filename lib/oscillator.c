@@ -1,51 +1,24 @@
 #include "oscillator.h"
 
 void init_oscillator(Oscillator *osc, float frequency, float sample_rate) {
-	osc->phase = 0.0f;
-	osc->phase_increment = (M_2PI * frequency) / sample_rate;
+	init_sine_lut();
+	osc->phase = 0;
+	osc->remainder = 0;
 	osc->sample_rate = sample_rate;
+	change_oscillator_frequency(osc, frequency);
 }
 
-inline void change_oscillator_frequency(Oscillator *osc, float frequency) {
-	osc->phase_increment = (M_2PI * frequency) / osc->sample_rate;
+void change_oscillator_frequency(Oscillator *osc, float frequency) {
+	uint64_t numerator = (uint64_t)llround(frequency * OSCILLATOR_FREQUENCY_STEPS) << 32;
+	uint64_t denominator = (uint64_t)llround(osc->sample_rate) * OSCILLATOR_FREQUENCY_STEPS;
+	if(frequency < 0.0f || denominator == 0 || denominator > UINT32_MAX) { // nothing here uses these, the plain rounded increment does
+		osc->phase_increment = frequency_to_phase_increment(frequency, osc->sample_rate);
+		osc->remainder_increment = 0;
+		osc->denominator = 1;
+		return;
+	}
+	osc->phase_increment = (uint32_t)(numerator / denominator);
+	osc->remainder_increment = (uint32_t)(numerator % denominator);
+	osc->denominator = (uint32_t)denominator;
+	if(osc->remainder >= osc->denominator) osc->remainder = 0;
 }
-
-float get_oscillator_sin_sample(Oscillator *osc) {
-	float sample = sinf(osc->phase);
-	advance_oscillator(osc);
-	return sample;
-}
-
-float get_oscillator_cos_sample(Oscillator *osc) {
-	float sample = cosf(osc->phase);
-	advance_oscillator(osc);
-	return sample;
-}
-
-float get_oscillator_sin_multiplier_ni(Oscillator *osc, float multiplier) {
-	return sinf(osc->phase * multiplier);
-}
-
-float get_oscillator_cos_multiplier_ni(Oscillator *osc, float multiplier) {
-	return cosf(osc->phase * multiplier);
-}
-
-inline bool advance_oscillator(Oscillator *osc) {
-	osc->phase += osc->phase_increment;
-	if (osc->phase >= M_2PI) {
-		osc->phase -= M_2PI;
-		return true;
-	} return false;
-}
-
-bool oscillator_did_cycle(Oscillator *osc, float phase_shift, float *prev_shifted_phase) {
-    float shifted = osc->phase + phase_shift;
-
-    // wrap into [0, 2π)
-    while (shifted >= M_2PI) shifted -= M_2PI;
-    while (shifted < 0.0f)   shifted += M_2PI;
-
-    bool crossed = shifted < *prev_shifted_phase;
-    *prev_shifted_phase = shifted;
-    return crossed;
-}
\ No newline at end of file
@@ -1,20 +1,61 @@
 #pragma once
 
 #include "constants.h"
+#include "sine_lut.h"
 #include <stdbool.h>
+#include <stdint.h>
 #include <math.h>
 
+#define OSCILLATOR_FREQUENCY_STEPS 256 // frequencies are exact to 1/256 Hz, which covers 1187.5
+
+// 2^32 of phase is a cycle. The increment frequency * 2^32 / sample_rate is a fraction, its remainder is carried over like a line drawing DDA so the average frequency is exact over any uptime
 typedef struct {
-	float phase;
-	float phase_increment;
+	uint32_t phase;
+	uint32_t phase_increment;
+	uint32_t remainder;
+	uint32_t remainder_increment;
+	uint32_t denominator;
 	float sample_rate;
 } Oscillator;
 
 void init_oscillator(Oscillator *osc, float frequency, float sample_rate);
 void change_oscillator_frequency(Oscillator *osc, float frequency);
-float get_oscillator_sin_sample(Oscillator *osc);
-float get_oscillator_cos_sample(Oscillator *osc);
-float get_oscillator_sin_multiplier_ni(Oscillator *osc, float multiplier);
-float get_oscillator_cos_multiplier_ni(Oscillator *osc, float multiplier);
-bool advance_oscillator(Oscillator *osc);
-bool oscillator_did_cycle(Oscillator *osc, float phase_shift, float *prev_shifted_phase);
\ No newline at end of file
+
+// True when the phase wrapped
+static inline bool advance_oscillator(Oscillator *osc) {
+	uint32_t old = osc->phase;
+	osc->phase += osc->phase_increment;
+	osc->remainder += osc->remainder_increment;
+	if(osc->remainder >= osc->denominator) {
+		osc->remainder -= osc->denominator;
+		osc->phase++;
+	}
+	return osc->phase < old;
+}
+
+// The harmonics wrap on their own, so these are just a multiply
+static inline float get_oscillator_sin_multiplier_ni(const Oscillator *osc, uint32_t multiplier) {
+	return sine_lut(osc->phase * multiplier);
+}
+static inline float get_oscillator_cos_multiplier_ni(const Oscillator *osc, uint32_t multiplier) {
+	return cosine_lut(osc->phase * multiplier);
+}
+
+static inline float get_oscillator_sin_sample(Oscillator *osc) {
+	float sample = sine_lut(osc->phase);
+	advance_oscillator(osc);
+	return sample;
+}
+static inline float get_oscillator_cos_sample(Oscillator *osc) {
+	float sample = cosine_lut(osc->phase);
+	advance_oscillator(osc);
+	return sample;
+}
+
+// Whether the phase, shifted by phase_shift, went past zero since the last call
+static inline bool oscillator_did_cycle(const Oscillator *osc, uint32_t phase_shift, uint32_t *prev_shifted_phase) {
+	uint32_t shifted = osc->phase + phase_shift;
+	bool crossed = shifted < *prev_shifted_phase;
+	*prev_shifted_phase = shifted;
+	return crossed;
+}
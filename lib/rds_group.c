@@ -0,0 +1,55 @@
+#include "rds_group.h"
+#include <pthread.h>
+
+#define RDS_POLY 0x5B9 // x^10 + x^8 + x^7 + x^5 + x^4 + x^3 + 1
+
+// The CRC is linear, so the remainder of a word is the remainder of its high byte xor that of its low byte
+static uint16_t crc_hi[256], crc_lo[256];
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+
+static uint16_t crc_bitwise(uint16_t info) {
+	uint32_t reg = (uint32_t)info << 10;
+	for(int bit = 25; bit >= 10; bit--) {
+		if(reg & (1u << bit)) reg ^= (uint32_t)RDS_POLY << (bit - 10);
+	}
+	return reg & 0x3FF;
+}
+
+static void fill_crc_tables(void) {
+	for(uint16_t i = 0; i < 256; i++) {
+		crc_hi[i] = crc_bitwise(i << 8);
+		crc_lo[i] = crc_bitwise(i);
+	}
+}
+
+uint16_t rds_checkword(uint16_t info, uint16_t offset) {
+	pthread_once(&crc_once, fill_crc_tables);
+	return (crc_hi[info >> 8] ^ crc_lo[info & 0xFF]) ^ offset;
+}
+
+void encode_rds_groups(const uint16_t* blocks, size_t groups, uint8_t* out) {
+	pthread_once(&crc_once, fill_crc_tables);
+	for(size_t g = 0; g < groups; g++, blocks += RDS_GROUP_BLOCKS, out += RDS_GROUP_BYTES) {
+		uint16_t offset_c = (blocks[1] & 0x0800) ? RDS_OFFSET_CP : RDS_OFFSET_C; // B0 bit of the group type
+		uint16_t offsets[RDS_GROUP_BLOCKS] = {RDS_OFFSET_A, RDS_OFFSET_B, offset_c, RDS_OFFSET_D};
+
+		// 4 blocks of 26 bits make two 52 bit halves, each fits a 64 bit accumulator
+		for(int half = 0; half < 2; half++) {
+			uint64_t acc = 0;
+			for(int b = 0; b < 2; b++) {
+				uint16_t info = blocks[half * 2 + b];
+				uint16_t check = (crc_hi[info >> 8] ^ crc_lo[info & 0xFF]) ^ offsets[half * 2 + b];
+				acc = (acc << 26) | ((uint64_t)info << 10) | check;
+			}
+			// 52 bits are 6.5 bytes, the halves meet in the middle of byte 6
+			uint8_t* o = out + half * 6;
+			if(half == 0) {
+				for(int i = 0; i < 6; i++) o[i] = acc >> (44 - 8 * i);
+				o[6] = (acc & 0xF) << 4;
+			} else {
+				o[0] |= acc >> 48;
+				for(int i = 1; i < 7; i++) o[i] = acc >> (48 - 8 * i);
+			}
+		}
+	}
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RDS_GROUP_BLOCKS 4
+#define RDS_GROUP_BITS 104 // 4 blocks of 16 information and 10 check bits
+#define RDS_GROUP_BYTES (RDS_GROUP_BITS / 8)
+
+// Offset words of IEC 62106, C' replaces C in version B groups
+#define RDS_OFFSET_A 0x0FC
+#define RDS_OFFSET_B 0x198
+#define RDS_OFFSET_C 0x168
+#define RDS_OFFSET_CP 0x350
+#define RDS_OFFSET_D 0x1B4
+
+uint16_t rds_checkword(uint16_t info, uint16_t offset);
+// Serializes groups of 4 information words into packed bits, MSB first, 13 bytes per group
+void encode_rds_groups(const uint16_t* blocks, size_t groups, uint8_t* out);
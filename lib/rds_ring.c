@@ -0,0 +1,58 @@
+#include "rds_ring.h"
+
+#include <stdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void reset_ring(RdsRingShared* ring) {
+	memset(ring, 0, sizeof(RdsRingShared));
+	ring->capacity = RDS_RING_BYTES;
+	ring->low_water = RDS_RING_LOW_WATER;
+	ring->version = RDS_RING_VERSION;
+	atomic_thread_fence(memory_order_release);
+	ring->magic = RDS_RING_MAGIC;
+}
+
+// /dev/shm/fm95.rds<stream> (or fm95.<station>.rds<stream>), for the RDS encoder to map
+int init_rds_ring(RdsRing* r, const char* station, uint8_t stream, uint32_t mode) {
+	memset(r, 0, sizeof(RdsRing));
+	if(station == NULL || station[0] == '\0') snprintf(r->name, sizeof(r->name), RDS_RING_NAME_PREFIX ".rds%u", stream);
+	else snprintf(r->name, sizeof(r->name), RDS_RING_NAME_PREFIX ".%s.rds%u", station, stream);
+
+	void* ring = MAP_FAILED;
+	int fd = shm_open(r->name, O_CREAT | O_RDWR, 0666);
+	if(fd >= 0) {
+		if(mode != 0 && fchmod(fd, mode) != 0) fprintf(stderr, "Could not set the mode of %s: %s\n", r->name, strerror(errno));
+		if(ftruncate(fd, sizeof(RdsRingShared)) == 0) ring = mmap(NULL, sizeof(RdsRingShared), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+	if(ring == MAP_FAILED) {
+		fprintf(stderr, "Could not share the RDS ring at %s: %s, only the socket can feed it\n", r->name, strerror(errno));
+		if(fd >= 0) shm_unlink(r->name);
+		ring = mmap(NULL, sizeof(RdsRingShared), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(ring == MAP_FAILED) return -1;
+	} else r->shared = true;
+
+	r->ring = ring;
+	reset_ring(r->ring);
+
+	r->local = mmap(NULL, sizeof(RdsRingShared), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if(r->local == MAP_FAILED) {
+		r->local = NULL;
+		return -1;
+	}
+	reset_ring(r->local);
+	return 0;
+}
+
+void exit_rds_ring(RdsRing* r) {
+	if(r->local != NULL) munmap(r->local, sizeof(RdsRingShared));
+	r->local = NULL;
+	if(r->ring == NULL) return;
+	r->ring->magic = 0;
+	munmap(r->ring, sizeof(RdsRingShared));
+	if(r->shared) shm_unlink(r->name);
+	r->ring = NULL;
+}
@@ -0,0 +1,128 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#define RDS_RING_MAGIC 0x53445246u // "FRDS"
+#define RDS_RING_VERSION 1
+#define RDS_RING_NAME_PREFIX "/fm95"
+#define RDS_RING_BYTES 2048 // 16384 bits, almost 14 seconds at 1187.5 bps, a power of two
+#define RDS_RING_BITS (RDS_RING_BYTES * 8)
+#define RDS_RING_LOW_WATER 4096 // bits, the doorbell rings below this
+
+/*
+ * Packed RDS bits, MSB first, from one encoder to the modulator. The
+ * producer only moves head and the consumer only moves tail, both count
+ * bits and never wrap in practice. Producers write whole bytes, so head
+ * stays a multiple of 8.
+ *
+ * The page is writable by whoever feeds it, so nothing in it is trusted:
+ * indexes are masked with the compile-time size, capacity is only there
+ * for the encoders, and a fill past the size counts as full.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t capacity; // bytes of data
+	uint32_t low_water; // bits
+	_Alignas(64) _Atomic uint64_t head;
+	_Alignas(64) _Atomic uint64_t tail;
+	_Alignas(64) _Atomic uint32_t doorbell; // futex word, bumped when the fill drops under low_water
+	_Atomic uint32_t waiting; // set by a producer sleeping on the doorbell
+	_Alignas(64) uint8_t data[RDS_RING_BYTES];
+} RdsRingShared;
+
+#define RDS_OWNER_NONE 0
+#define RDS_OWNER_SHM 1
+#define RDS_OWNER_SOCKET 2
+
+// A stream belongs to whichever of the shared ring and the socket feeds it first, until fm95 restarts
+typedef struct {
+	RdsRingShared* ring; // the shared one, for the encoders
+	RdsRingShared* local; // private, only the socket commands write it
+	_Atomic uint8_t owner;
+	char name[64];
+	bool shared;
+} RdsRing;
+
+// mode 0 leaves the permissions to the umask
+int init_rds_ring(RdsRing* r, const char* station, uint8_t stream, uint32_t mode);
+void exit_rds_ring(RdsRing* r);
+
+static inline uint64_t rds_ring_fill(const RdsRingShared* r) {
+	uint64_t fill = atomic_load_explicit((_Atomic uint64_t*)&r->head, memory_order_acquire) - atomic_load_explicit((_Atomic uint64_t*)&r->tail, memory_order_acquire);
+	return (fill > RDS_RING_BITS) ? RDS_RING_BITS : fill;
+}
+
+// Producer side, bytes that can be written right now
+static inline size_t rds_ring_space(const RdsRingShared* r) {
+	return (size_t)(RDS_RING_BITS - rds_ring_fill(r)) / 8;
+}
+
+// Producer side, returns how many bytes fit
+static inline size_t rds_ring_write(RdsRingShared* r, const uint8_t* bytes, size_t n) {
+	uint64_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+	uint64_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+	uint64_t fill = head - tail;
+	if(fill > RDS_RING_BITS) fill = RDS_RING_BITS;
+	size_t space = (size_t)(RDS_RING_BITS - fill) / 8;
+	if(n > space) n = space;
+	size_t pos = (head / 8) & (RDS_RING_BYTES - 1);
+	size_t first = (n < RDS_RING_BYTES - pos) ? n : RDS_RING_BYTES - pos;
+	memcpy(r->data + pos, bytes, first);
+	memcpy(r->data, bytes + first, n - first);
+	atomic_store_explicit(&r->head, head + n * 8, memory_order_release);
+	return n;
+}
+
+// Producer side, sleeps until the ring runs low or the timeout (ms, negative for none) passes
+static inline void rds_ring_wait(RdsRingShared* r, int timeout_ms) {
+	uint32_t bell = atomic_load(&r->doorbell);
+	atomic_store(&r->waiting, 1);
+	if(rds_ring_fill(r) < r->low_water) {
+		atomic_store(&r->waiting, 0);
+		return;
+	}
+	struct timespec ts = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+	syscall(SYS_futex, &r->doorbell, FUTEX_WAIT, bell, timeout_ms < 0 ? NULL : &ts, NULL, 0);
+}
+
+// Consumer side, returns 1 if a bit was available, 0 on underrun
+static inline int rds_ring_read1(RdsRingShared* r, uint8_t* out) {
+	uint64_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+	uint64_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+	if(head == tail) return 0;
+	*out = (r->data[(tail / 8) & (RDS_RING_BYTES - 1)] >> (7 - (tail & 7))) & 1;
+	atomic_store_explicit(&r->tail, tail + 1, memory_order_seq_cst);
+
+	// Only a syscall when someone asked for it, at most once per wait
+	if(head - tail - 1 < r->low_water && atomic_load_explicit(&r->waiting, memory_order_seq_cst) && atomic_exchange(&r->waiting, 0)) {
+		atomic_fetch_add(&r->doorbell, 1);
+		syscall(SYS_futex, &r->doorbell, FUTEX_WAKE, 1, NULL, NULL, 0);
+	}
+	return 1;
+}
+
+// Consumer side, the next bit from whichever ring owns the stream
+static inline int rds_ring_next_bit(RdsRing* r, uint8_t* out) {
+	uint8_t owner = atomic_load_explicit(&r->owner, memory_order_acquire);
+	if(owner == RDS_OWNER_SOCKET) return rds_ring_read1(r->local, out);
+	if(r->ring == NULL || !rds_ring_read1(r->ring, out)) return 0;
+	if(owner == RDS_OWNER_NONE && !atomic_compare_exchange_strong(&r->owner, &owner, RDS_OWNER_SHM)) return rds_ring_read1(r->local, out); // the socket got there first
+	return 1;
+}
+
+// The ring the socket commands may write, NULL when an encoder already feeds the stream through shared memory
+static inline RdsRingShared* rds_ring_socket(RdsRing* r) {
+	if(r->local == NULL) return NULL;
+	uint8_t owner = RDS_OWNER_NONE;
+	if(atomic_compare_exchange_strong(&r->owner, &owner, RDS_OWNER_SOCKET) || owner == RDS_OWNER_SOCKET) return r->local;
+	return NULL;
+}
@@ -0,0 +1,239 @@
+#define _GNU_SOURCE
+#include "recorder.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#define WAV_HEADER_SIZE 44
+#define WAV_MAX_DATA (0xFFFFFFFFu - WAV_HEADER_SIZE)
+
+static void put_u16(uint8_t* p, uint16_t v) { p[0] = v; p[1] = v >> 8; }
+static void put_u32(uint8_t* p, uint32_t v) { p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24; }
+
+// 32-bit float WAV, the sizes get patched in when the segment is closed
+static void wav_header(uint8_t* h, uint8_t channels, uint32_t sample_rate, uint32_t data_size) {
+	memcpy(h, "RIFF", 4);
+	put_u32(h + 4, 36 + data_size);
+	memcpy(h + 8, "WAVEfmt ", 8);
+	put_u32(h + 16, 16);
+	put_u16(h + 20, 3); // WAVE_FORMAT_IEEE_FLOAT
+	put_u16(h + 22, channels);
+	put_u32(h + 24, sample_rate);
+	put_u32(h + 28, sample_rate * channels * sizeof(float));
+	put_u16(h + 32, channels * sizeof(float));
+	put_u16(h + 34, 32);
+	memcpy(h + 36, "data", 4);
+	put_u32(h + 40, data_size);
+}
+
+static int write_all(int fd, const void* data, size_t size, uint64_t offset) {
+	const uint8_t* p = data;
+	while(size > 0) {
+		ssize_t n = pwrite(fd, p, size, offset);
+		if(n < 0) {
+			if(errno == EINTR) continue;
+			return -1;
+		}
+		p += n;
+		size -= n;
+		offset += n;
+	}
+	return 0;
+}
+
+// Writes the whole aligned part of the stage and keeps the rest for later
+static void flush_stage(Recorder* rec, bool all) {
+	if(rec->fd < 0) { // nowhere to put it, but the stage must not fill up
+		rec->stage_len = 0;
+		return;
+	}
+	size_t len = rec->direct && !all ? rec->stage_len & ~(size_t)(RECORDER_ALIGN - 1) : rec->stage_len;
+	if(len == 0) return;
+	if(rec->direct && len % RECORDER_ALIGN != 0) {
+		// The odd tail of a segment goes through the page cache
+		fcntl(rec->fd, F_SETFL, fcntl(rec->fd, F_GETFL) & ~O_DIRECT);
+		rec->direct = false;
+	}
+	int err = write_all(rec->fd, rec->stage, len, rec->file_offset);
+	if(err != 0 && errno == EINVAL && rec->direct) {
+		// Some filesystems take O_DIRECT at open and then refuse the writes, go through the page cache for the rest of the segment
+		fcntl(rec->fd, F_SETFL, fcntl(rec->fd, F_GETFL) & ~O_DIRECT);
+		rec->direct = false;
+		err = write_all(rec->fd, rec->stage, len, rec->file_offset);
+	}
+	if(err != 0) fprintf(stderr, "Recorder could not write %s: %s\n", rec->path, strerror(errno));
+	memmove(rec->stage, rec->stage + len, rec->stage_len - len);
+	rec->stage_len -= len;
+	rec->file_offset += len;
+}
+
+static void delete_old_segments(Recorder* rec) {
+	if(rec->keep_seconds == 0) return;
+	DIR* dir = opendir(rec->dir);
+	if(dir == NULL) return;
+	time_t cutoff = time(NULL) - rec->keep_seconds;
+	size_t prefix_len = strlen(rec->prefix);
+	struct dirent* entry;
+	while((entry = readdir(dir)) != NULL) {
+		if(strncmp(entry->d_name, rec->prefix, prefix_len) != 0 || entry->d_name[prefix_len] != '-') continue;
+		struct stat st;
+		if(fstatat(dirfd(dir), entry->d_name, &st, 0) != 0 || st.st_mtime >= cutoff) continue;
+		if(unlinkat(dirfd(dir), entry->d_name, 0) != 0) fprintf(stderr, "Recorder could not remove %s: %s\n", entry->d_name, strerror(errno));
+	}
+	closedir(dir);
+}
+
+static void close_segment(Recorder* rec) {
+	if(rec->fd < 0) return;
+	flush_stage(rec, true);
+	uint8_t header[WAV_HEADER_SIZE];
+	wav_header(header, rec->channels, rec->sample_rate, rec->frames * rec->channels * sizeof(float));
+	if(rec->direct) fcntl(rec->fd, F_SETFL, fcntl(rec->fd, F_GETFL) & ~O_DIRECT);
+	if(write_all(rec->fd, header, sizeof(header), 0) != 0) fprintf(stderr, "Recorder could not finish %s: %s\n", rec->path, strerror(errno));
+	close(rec->fd);
+	rec->fd = -1;
+}
+
+static void open_segment(Recorder* rec) {
+	time_t now = time(NULL);
+	struct tm tm;
+	gmtime_r(&now, &tm);
+	char stamp[32];
+	strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &tm);
+	// Never overwrite, a quick restart could land in the same second
+	for(int n = 0; n < 100; n++) {
+		int len;
+		if(n == 0) len = snprintf(rec->path, sizeof(rec->path), "%s/%s-%s.wav", rec->dir, rec->prefix, stamp);
+		else len = snprintf(rec->path, sizeof(rec->path), "%s/%s-%s-%d.wav", rec->dir, rec->prefix, stamp, n);
+		if(len < 0 || (size_t)len >= sizeof(rec->path)) { // a cut short name would be some other file
+			rec->fd = -1;
+			errno = ENAMETOOLONG;
+			break;
+		}
+
+		rec->direct = true;
+		rec->fd = open(rec->path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC | O_DIRECT, 0644);
+		if(rec->fd < 0 && errno == EINVAL) { // tmpfs and friends
+			rec->direct = false;
+			rec->fd = open(rec->path, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+		}
+		if(rec->fd >= 0 || errno != EEXIST) break;
+	}
+	if(rec->fd < 0) fprintf(stderr, "Recorder could not create %s: %s\n", rec->path, strerror(errno));
+
+	// The header rides in the first write so the samples keep the file aligned
+	wav_header(rec->stage, rec->channels, rec->sample_rate, 0);
+	rec->stage_len = WAV_HEADER_SIZE;
+	rec->file_offset = 0;
+	rec->frames = 0;
+}
+
+static void* recorder_thread(void* arg) {
+	Recorder* rec = arg;
+	size_t block_bytes = rec->block_samples * sizeof(float);
+	double block_seconds = (double)rec->block_samples / rec->channels / rec->sample_rate;
+	struct timespec nap = { 0, (long)(block_seconds * 0.5e9) };
+	if(nap.tv_nsec < 5000000) nap.tv_nsec = 5000000;
+
+	delete_old_segments(rec);
+	open_segment(rec);
+
+	while(1) {
+		size_t tail = atomic_load_explicit(&rec->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&rec->head, memory_order_acquire);
+		if(head == tail) {
+			if(!rec->running) break;
+			nanosleep(&nap, NULL);
+			continue;
+		}
+
+		for(; tail != head; tail++) {
+			if(rec->stage_len + block_bytes > RECORDER_STAGE_SIZE) flush_stage(rec, false);
+			memcpy(rec->stage + rec->stage_len, rec->slots + (tail % RECORDER_SLOTS) * rec->block_samples, block_bytes);
+			rec->stage_len += block_bytes;
+			rec->frames += rec->block_samples / rec->channels;
+			atomic_store_explicit(&rec->tail, tail + 1, memory_order_release);
+
+			if(rec->frames >= rec->segment_frames) {
+				close_segment(rec);
+				uint64_t dropped = rec->dropped; // a racy read of a counter is fine here
+				if(dropped != rec->reported_drops) {
+					fprintf(stderr, "Recorder %s dropped %lu blocks so far\n", rec->prefix, (unsigned long)dropped);
+					rec->reported_drops = dropped;
+				}
+				delete_old_segments(rec);
+				open_segment(rec);
+			}
+		}
+	}
+
+	close_segment(rec);
+	return NULL;
+}
+
+int init_recorder(Recorder* rec, const char* dir, const char* prefix, uint8_t channels, uint32_t sample_rate, size_t block_frames, uint32_t segment_seconds, uint32_t keep_hours) {
+	memset(rec, 0, sizeof(Recorder));
+	rec->fd = -1;
+	if(strlen(dir) >= sizeof(rec->dir)) {
+		fprintf(stderr, "Recorder directory %s is too long, at most %zu characters\n", dir, sizeof(rec->dir) - 1);
+		return -1;
+	}
+	if(strlen(prefix) >= sizeof(rec->prefix)) {
+		fprintf(stderr, "Recorder file prefix %s is too long, at most %zu characters, use a shorter station name\n", prefix, sizeof(rec->prefix) - 1);
+		return -1;
+	}
+	snprintf(rec->dir, sizeof(rec->dir), "%s", dir);
+	snprintf(rec->prefix, sizeof(rec->prefix), "%s", prefix);
+	rec->channels = channels;
+	rec->sample_rate = sample_rate;
+	rec->block_samples = block_frames * channels;
+	rec->keep_seconds = keep_hours * 3600;
+
+	uint64_t max_frames = WAV_MAX_DATA / (channels * sizeof(float));
+	rec->segment_frames = (uint64_t)segment_seconds * sample_rate;
+	if(rec->segment_frames == 0 || rec->segment_frames > max_frames) rec->segment_frames = max_frames - block_frames;
+	if(rec->block_samples * sizeof(float) + WAV_HEADER_SIZE > RECORDER_STAGE_SIZE) {
+		fprintf(stderr, "Recorder blocks are too big\n");
+		return -1;
+	}
+
+	if(mkdir(dir, 0755) != 0 && errno != EEXIST) {
+		fprintf(stderr, "Recorder could not create %s: %s\n", dir, strerror(errno));
+		return -1;
+	}
+
+	rec->slots = malloc(RECORDER_SLOTS * rec->block_samples * sizeof(float));
+	if(rec->slots == NULL || posix_memalign((void**)&rec->stage, RECORDER_ALIGN, RECORDER_STAGE_SIZE) != 0) {
+		free(rec->slots);
+		rec->slots = NULL;
+		return -1;
+	}
+
+	rec->running = true;
+	if(pthread_create(&rec->thread, NULL, recorder_thread, rec) != 0) {
+		rec->running = false;
+		free(rec->slots);
+		free(rec->stage);
+		rec->slots = NULL;
+		return -1;
+	}
+	return 0;
+}
+
+// The writer drains what is queued before it goes
+void exit_recorder(Recorder* rec) {
+	if(!rec->running) return;
+	rec->running = false;
+	pthread_join(rec->thread, NULL);
+	if(rec->dropped) fprintf(stderr, "Recorder %s dropped %lu blocks\n", rec->prefix, (unsigned long)rec->dropped);
+	free(rec->slots);
+	free(rec->stage);
+	rec->slots = NULL;
+	rec->stage = NULL;
+}
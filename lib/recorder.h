@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+
+#define RECORDER_SLOTS 32 // blocks the writer may fall behind before we drop
+#define RECORDER_STAGE_SIZE (1 << 20) // bytes per write
+#define RECORDER_ALIGN 4096 // O_DIRECT wants buffers, offsets and sizes aligned to this
+
+// Float blocks from the DSP thread into rotating WAV files, written on a thread of its own
+typedef struct {
+	float* slots;
+	size_t block_samples; // frames times channels
+	_Alignas(64) atomic_size_t head;
+	_Alignas(64) atomic_size_t tail;
+	uint64_t dropped; // only the DSP thread writes it
+
+	pthread_t thread;
+	volatile bool running;
+
+	char dir[128];
+	char prefix[32];
+	uint8_t channels;
+	uint32_t sample_rate;
+	uint64_t segment_frames;
+	uint32_t keep_seconds;
+
+	// Only the writer touches these
+	int fd;
+	bool direct;
+	char path[256]; // fits dir, prefix, the stamp and the counter
+	uint8_t* stage;
+	size_t stage_len;
+	uint64_t file_offset; // of the start of the stage
+	uint64_t frames; // in the current segment
+	uint64_t reported_drops;
+} Recorder;
+
+int init_recorder(Recorder* rec, const char* dir, const char* prefix, uint8_t channels, uint32_t sample_rate, size_t block_frames, uint32_t segment_seconds, uint32_t keep_hours);
+void exit_recorder(Recorder* rec);
+
+// Called by the DSP thread, one memcpy and never a syscall, drops the block if the writer is behind
+static inline bool record_block(Recorder* rec, const float* block) {
+	size_t head = atomic_load_explicit(&rec->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&rec->tail, memory_order_acquire);
+	if(head - tail >= RECORDER_SLOTS) {
+		rec->dropped++;
+		return false;
+	}
+	memcpy(rec->slots + (head % RECORDER_SLOTS) * rec->block_samples, block, rec->block_samples * sizeof(float));
+	atomic_store_explicit(&rec->head, head + 1, memory_order_release);
+	return true;
+}
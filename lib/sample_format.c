@@ -0,0 +1,252 @@
+#include "sample_format.h"
+
+#include <string.h>
+#include <strings.h>
+#include "simd.h"
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+typedef int16_t v4hi __attribute__((vector_size(8)));
+typedef uint8_t v4qu __attribute__((vector_size(4)));
+typedef uint32_t v4su __attribute__((vector_size(16)));
+
+const uint8_t sample_format_bytes[SAMPLE_FORMATS] = {1, 2, 3, 4, 4};
+
+// Little endian payloads, same as what the VBAN senders put on the wire
+void decode_samples(const void* in, float* out, size_t count, uint8_t format) {
+	const uint8_t* p = in;
+	size_t i = 0;
+	switch(format) {
+		case SAMPLE_U8: {
+			v4si bias = {128, 128, 128, 128};
+			v4sf scale = v4sf_set1(1.0f / 128.0f);
+			for(; i + 4 <= count; i += 4) {
+				v4qu v;
+				memcpy(&v, p + i, sizeof(v));
+				v4sf_store(out + i, v4si_to_v4sf(__builtin_convertvector(v, v4si) - bias) * scale);
+			}
+			for(; i < count; i++) out[i] = (p[i] - 128) / 128.0f;
+			break;
+		}
+		case SAMPLE_S16: {
+			v4sf scale = v4sf_set1(1.0f / 32768.0f);
+			for(; i + 4 <= count; i += 4) {
+				v4hi v;
+				memcpy(&v, p + i * 2, sizeof(v));
+				v4sf_store(out + i, v4si_to_v4sf(__builtin_convertvector(v, v4si)) * scale);
+			}
+			for(; i < count; i++) {
+				int16_t v;
+				memcpy(&v, p + i * 2, sizeof(v));
+				out[i] = v / 32768.0f;
+			}
+			break;
+		}
+		case SAMPLE_S24: {
+			// Each packed sample is put together from its three bytes into the top of a lane, four lanes then convert and scale at once
+			v4sf scale = v4sf_set1(1.0f / 2147483648.0f);
+			for(; i + 4 <= count; i += 4) {
+				const uint8_t* s = p + i * 3;
+				v4si v = {
+					(int32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24)),
+					(int32_t)(((uint32_t)s[3] << 8) | ((uint32_t)s[4] << 16) | ((uint32_t)s[5] << 24)),
+					(int32_t)(((uint32_t)s[6] << 8) | ((uint32_t)s[7] << 16) | ((uint32_t)s[8] << 24)),
+					(int32_t)(((uint32_t)s[9] << 8) | ((uint32_t)s[10] << 16) | ((uint32_t)s[11] << 24))
+				};
+				v4sf_store(out + i, v4si_to_v4sf(v) * scale);
+			}
+			for(; i < count; i++) {
+				const uint8_t* s = p + i * 3;
+				out[i] = (int32_t)(((uint32_t)s[0] << 8) | ((uint32_t)s[1] << 16) | ((uint32_t)s[2] << 24)) / 2147483648.0f;
+			}
+			break;
+		}
+		case SAMPLE_S32: {
+			v4sf scale = v4sf_set1(1.0f / 2147483648.0f);
+			for(; i + 4 <= count; i += 4) {
+				v4si v;
+				memcpy(&v, p + i * 4, sizeof(v));
+				v4sf_store(out + i, v4si_to_v4sf(v) * scale);
+			}
+			for(; i < count; i++) {
+				int32_t v;
+				memcpy(&v, p + i * 4, sizeof(v));
+				out[i] = v / 2147483648.0f;
+			}
+			break;
+		}
+		default:
+			memcpy(out, in, count * sizeof(float));
+			break;
+	}
+}
+
+static const char* const sample_format_names[SAMPLE_FORMATS] = {"u8", "s16", "s24", "s32", "f32"};
+
+int parse_sample_format(const char* name) {
+	for(int i = 0; i < SAMPLE_FORMATS; i++) {
+		if(strcasecmp(name, sample_format_names[i]) == 0) return i;
+	}
+	return -1;
+}
+
+void init_sample_dither(SampleDither* dither, uint32_t seed) {
+	for(int i = 0; i < 4; i++) {
+		seed = seed * 1664525u + 1013904223u;
+		dither->state[i] = seed | 1; // xorshift never leaves zero
+	}
+}
+
+// Triangular between -65535 and 65535, in 1/65536 of an LSB
+static inline v4si tpdf_v4(SampleDither* dither) {
+	v4su s;
+	memcpy(&s, dither->state, sizeof(s));
+	s ^= s << 13;
+	s ^= s >> 17;
+	s ^= s << 5;
+	memcpy(dither->state, &s, sizeof(s));
+	return (v4si)(s & 0xffff) + (v4si)(s >> 16) - 65535;
+}
+
+// Four Q31 samples out in the format, the integer formats keep the top bits rounded to nearest
+static inline void encode_q31_v4(v4si q, uint8_t* out, uint8_t format, SampleDither* dither) {
+	int shift = 32 - sample_format_bytes[format] * 8;
+	if(dither != NULL && shift != 0) {
+		v4si d = tpdf_v4(dither);
+		d = (shift >= 16) ? d << (shift - 16) : d >> (16 - shift);
+		v4si sum = (v4si)((v4su)q + (v4su)d);
+		v4si overflow = ((q ^ sum) & (d ^ sum)) < 0;
+		sum = (overflow & ((q >> 31) ^ INT32_MAX)) | (~overflow & sum);
+		q = sum;
+	}
+	switch(format) {
+		case SAMPLE_U8: {
+			v4si v = (q >> 24) + ((q >> 23) & 1);
+			v4si top = v > 127;
+			v = (top & 127) | (~top & v);
+			v4qu b = __builtin_convertvector(v + 128, v4qu);
+			memcpy(out, &b, sizeof(b));
+			break;
+		}
+		case SAMPLE_S16: {
+#ifdef __ARM_NEON
+			vst1_s16((int16_t*)out, vqrshrn_n_s32((int32x4_t)q, 16));
+#else
+			v4si v = (q >> 16) + ((q >> 15) & 1);
+			v4si top = v > 32767;
+			v = (top & 32767) | (~top & v);
+			v4hi h = __builtin_convertvector(v, v4hi);
+			memcpy(out, &h, sizeof(h));
+#endif
+			break;
+		}
+		case SAMPLE_S24: {
+			v4si v = (q >> 8) + ((q >> 7) & 1);
+			v4si top = v > 8388607;
+			v = (top & 8388607) | (~top & v);
+			for(int i = 0; i < 4; i++) {
+				out[i * 3 + 0] = (uint8_t)v[i];
+				out[i * 3 + 1] = (uint8_t)(v[i] >> 8);
+				out[i * 3 + 2] = (uint8_t)(v[i] >> 16);
+			}
+			break;
+		}
+		default:
+			memcpy(out, &q, sizeof(q));
+			break;
+	}
+}
+
+// The tail goes through a zero padded vector, so every sample takes the same path
+void encode_q31_samples(const int32_t* in, void* out, size_t count, uint8_t format, SampleDither* dither) {
+	uint8_t* p = out;
+	if(format == SAMPLE_F32) {
+		float* f = out;
+		for(size_t i = 0; i < count; i++) f[i] = in[i] * (1.0f / 2147483648.0f);
+		return;
+	}
+	size_t bytes = sample_format_bytes[format];
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) encode_q31_v4(v4si_load(in + i), p + i * bytes, format, dither);
+	if(i < count) {
+		int32_t tail[4] = {0};
+		uint8_t packed[16];
+		memcpy(tail, in + i, (count - i) * sizeof(int32_t));
+		encode_q31_v4(v4si_load(tail), packed, format, dither);
+		memcpy(p + i * bytes, packed, (count - i) * bytes);
+	}
+}
+
+static inline v4si float_to_q31_v4(v4sf x) {
+	// 2147483520 is the largest float under 2^31
+	return v4sf_to_v4si(v4sf_clamp(x * v4sf_set1(2147483648.0f), v4sf_set1(-2147483648.0f), v4sf_set1(2147483520.0f)));
+}
+
+void encode_samples(const float* in, void* out, size_t count, uint8_t format, SampleDither* dither) {
+	uint8_t* p = out;
+	if(format == SAMPLE_F32) {
+		memcpy(out, in, count * sizeof(float));
+		return;
+	}
+	size_t bytes = sample_format_bytes[format];
+	size_t i = 0;
+	for(; i + 4 <= count; i += 4) encode_q31_v4(float_to_q31_v4(v4sf_load(in + i)), p + i * bytes, format, dither);
+	if(i < count) {
+		float tail[4] = {0};
+		uint8_t packed[16];
+		memcpy(tail, in + i, (count - i) * sizeof(float));
+		encode_q31_v4(float_to_q31_v4(v4sf_load(tail)), packed, format, dither);
+		memcpy(p + i * bytes, packed, (count - i) * bytes);
+	}
+}
+
+/*
+ * Without an explicit map: equal counts pass through, mono goes to every output, a mono output
+ * gets the average of everything, otherwise input channel n is mixed into output n % out_channels.
+ * An explicit map gives the input channel of each output, -1 for silence.
+ */
+int init_channel_map(ChannelMap* map, uint16_t in_channels, uint8_t out_channels, const int16_t* explicit_map) {
+	if(in_channels == 0 || out_channels == 0 || out_channels > MAX_REMAP_CHANNELS) return -1;
+	memset(map, 0, sizeof(ChannelMap));
+	map->in_channels = in_channels;
+	map->out_channels = out_channels;
+
+	for(uint8_t o = 0; o < out_channels; o++) {
+		if(explicit_map != NULL) {
+			if(explicit_map[o] >= 0 && explicit_map[o] < in_channels) {
+				map->sources[o][0] = explicit_map[o];
+				map->source_count[o] = 1;
+			}
+		} else if(in_channels <= out_channels) {
+			map->sources[o][0] = o % in_channels;
+			map->source_count[o] = 1;
+		} else {
+			for(uint16_t c = o; c < in_channels && map->source_count[o] < MAX_REMAP_CHANNELS; c += out_channels) map->sources[o][map->source_count[o]++] = c;
+		}
+		for(uint8_t s = 0; s < map->source_count[o]; s++) map->gains[o][s] = 1.0f / map->source_count[o];
+	}
+
+	map->identity = (in_channels == out_channels);
+	for(uint8_t o = 0; o < out_channels; o++) {
+		if(map->source_count[o] != 1 || map->sources[o][0] != o) map->identity = false;
+	}
+	return 0;
+}
+
+void remap_channels(const ChannelMap* map, const float* in, float* out, size_t frames) {
+	uint16_t ic = map->in_channels;
+	uint8_t oc = map->out_channels;
+	if(map->identity) {
+		memcpy(out, in, frames * oc * sizeof(float));
+		return;
+	}
+	for(size_t f = 0; f < frames; f++) {
+		for(uint8_t o = 0; o < oc; o++) {
+			float sum = 0.0f;
+			for(uint8_t s = 0; s < map->source_count[o]; s++) sum += in[f * ic + map->sources[o][s]] * map->gains[o][s];
+			out[f * oc + o] = sum;
+		}
+	}
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+
+// In VBAN's order, so a VBAN format index can be used as is
+#define SAMPLE_U8 0
+#define SAMPLE_S16 1
+#define SAMPLE_S24 2
+#define SAMPLE_S32 3
+#define SAMPLE_F32 4
+#define SAMPLE_FORMATS 5
+
+#define MAX_REMAP_CHANNELS 8
+
+extern const uint8_t sample_format_bytes[SAMPLE_FORMATS];
+
+void decode_samples(const void* in, float* out, size_t count, uint8_t format);
+
+// "u8", "s16", "s24", "s32" or "f32", -1 for anything else
+int parse_sample_format(const char* name);
+
+// TPDF dither, two uniforms of half an LSB each out of one xorshift per lane
+typedef struct {
+	uint32_t state[4];
+} SampleDither;
+
+void init_sample_dither(SampleDither* dither, uint32_t seed);
+
+// The other way, rounded and saturated, a NULL dither rounds plainly. F32 is copied and S32 is never dithered
+void encode_samples(const float* in, void* out, size_t count, uint8_t format, SampleDither* dither);
+void encode_q31_samples(const int32_t* in, void* out, size_t count, uint8_t format, SampleDither* dither);
+
+// Which input channels are summed into each output channel, with what gain
+typedef struct {
+	uint16_t in_channels;
+	uint8_t out_channels;
+	float gains[MAX_REMAP_CHANNELS][MAX_REMAP_CHANNELS];
+	uint16_t sources[MAX_REMAP_CHANNELS][MAX_REMAP_CHANNELS];
+	uint8_t source_count[MAX_REMAP_CHANNELS];
+	bool identity;
+} ChannelMap;
+
+int init_channel_map(ChannelMap* map, uint16_t in_channels, uint8_t out_channels, const int16_t* explicit_map);
+void remap_channels(const ChannelMap* map, const float* in, float* out, size_t frames);
@@ -0,0 +1,28 @@
+#include "sine_lut.h"
+#include "constants.h"
+#include <math.h>
+#include <pthread.h>
+
+float sine_lut_table[SINE_LUT_SIZE + 1];
+int32_t sine_lut_q31_table[SINE_LUT_SIZE + 1];
+
+static pthread_once_t sine_lut_once = PTHREAD_ONCE_INIT;
+
+static void fill_sine_lut(void) {
+	// One guard entry past the end so the interpolation never has to wrap the index
+	for(uint32_t i = 0; i <= SINE_LUT_SIZE; i++) {
+		double s = sin(M_2PI * i / SINE_LUT_SIZE);
+		sine_lut_table[i] = (float)s;
+		sine_lut_q31_table[i] = (int32_t)lrint(s * 2147483647.0);
+	}
+}
+
+void init_sine_lut(void) {
+	pthread_once(&sine_lut_once, fill_sine_lut);
+}
+
+uint32_t frequency_to_phase_increment(double frequency, double sample_rate) {
+	double increment = fmod(frequency / sample_rate, 1.0);
+	if(increment < 0.0) increment += 1.0;
+	return (uint32_t)llround(increment * 4294967296.0);
+}
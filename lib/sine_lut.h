@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+
+// Phases here are 32-bit unsigned integers, 2^32 being one full cycle, so wrapping is free
+#define SINE_LUT_BITS 10
+#define SINE_LUT_SIZE (1u << SINE_LUT_BITS)
+#define SINE_LUT_FRAC_BITS (32 - SINE_LUT_BITS)
+
+#define PHASE_QUARTER 0x40000000u
+
+extern float sine_lut_table[SINE_LUT_SIZE + 1];
+extern int32_t sine_lut_q31_table[SINE_LUT_SIZE + 1];
+
+void init_sine_lut(void);
+uint32_t frequency_to_phase_increment(double frequency, double sample_rate);
+
+static inline float sine_lut(uint32_t phase) {
+	uint32_t idx = phase >> SINE_LUT_FRAC_BITS;
+	float frac = (float)(phase & ((1u << SINE_LUT_FRAC_BITS) - 1)) * (1.0f / (float)(1u << SINE_LUT_FRAC_BITS));
+	float a = sine_lut_table[idx];
+	return a + (sine_lut_table[idx + 1] - a) * frac;
+}
+
+static inline float cosine_lut(uint32_t phase) {
+	return sine_lut(phase + PHASE_QUARTER);
+}
+
+// The same in Q31 for the fixed point build
+static inline int32_t sine_lut_q31(uint32_t phase) {
+	uint32_t idx = phase >> SINE_LUT_FRAC_BITS;
+	int64_t frac = phase & ((1u << SINE_LUT_FRAC_BITS) - 1);
+	int32_t a = sine_lut_q31_table[idx];
+	return a + (int32_t)(((int64_t)(sine_lut_q31_table[idx + 1] - a) * frac) >> SINE_LUT_FRAC_BITS);
+}
@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+#include "spectrum.h"
+#include "constants.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <math.h>
+#include <sched.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static void analyze_frame(SpectrumAnalyzer* sa) {
+	for(uint32_t i = 0; i < sa->fft_size; i++) sa->fft_in[i] = sa->pending[i] * sa->window[i];
+	fft_execute(sa->plan);
+
+	uint32_t bins = sa->fft_size / 2 + 1;
+	float alpha = (sa->frames == 0) ? 1.0f : sa->alpha;
+	for(uint32_t i = 0; i < bins; i++) {
+		float re = crealf(sa->fft_out[i]), im = cimagf(sa->fft_out[i]);
+		float power = (re * re + im * im) * sa->scale;
+		sa->average[i] += alpha * (power - sa->average[i]);
+	}
+	sa->frames++;
+}
+
+static void publish_spectrum(SpectrumAnalyzer* sa) {
+	SpectrumPage* page = sa->page;
+	unsigned int seq = atomic_load_explicit(&page->seq, memory_order_relaxed);
+	atomic_store_explicit(&page->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	for(uint32_t i = 0; i < page->bins; i++) page->power_db[i] = 10.0f * log10f(sa->average[i] + 1e-20f);
+	page->frames = sa->frames;
+	page->dropped = sa->tap.dropped; // a racy read of a counter is fine here
+	atomic_store_explicit(&page->seq, seq + 2, memory_order_release);
+}
+
+static void* spectrum_thread(void* arg) {
+	SpectrumAnalyzer* sa = arg;
+
+	// Only ever runs on time nobody else wants
+	struct sched_param param = {0};
+	if(pthread_setschedparam(pthread_self(), SCHED_IDLE, &param) != 0) fprintf(stderr, "Could not make the spectrum analyzer idle priority\n");
+
+	BlockTap* tap = &sa->tap;
+	double block_seconds = (double)tap->block_size / sa->page->sample_rate;
+	struct timespec nap = { 0, (long)(block_seconds * 0.25e9) };
+	if(nap.tv_nsec < 5000000) nap.tv_nsec = 5000000;
+
+	while(sa->running) {
+		size_t tail = atomic_load_explicit(&tap->tail, memory_order_relaxed);
+		size_t head = atomic_load_explicit(&tap->head, memory_order_acquire);
+		if(head == tail) {
+			nanosleep(&nap, NULL);
+			continue;
+		}
+
+		const float* block = tap->slots + (tail % SPECTRUM_TAP_SLOTS) * tap->block_size;
+		for(size_t i = 0; i < tap->block_size; i++) {
+			sa->pending[sa->pending_len++] = block[i];
+			if(sa->pending_len == sa->fft_size) {
+				analyze_frame(sa);
+				memmove(sa->pending, sa->pending + sa->hop, (sa->fft_size - sa->hop) * sizeof(float));
+				sa->pending_len = sa->fft_size - sa->hop;
+			}
+		}
+		atomic_store_explicit(&tap->tail, tail + 1, memory_order_release);
+		if(sa->frames != 0) publish_spectrum(sa);
+	}
+	return NULL;
+}
+
+static int map_page(SpectrumAnalyzer* sa) {
+	void* page = MAP_FAILED;
+	int fd = shm_open(sa->name, O_CREAT | O_RDWR, 0644);
+	if(fd >= 0) {
+		if(ftruncate(fd, sa->page_size) == 0) page = mmap(NULL, sa->page_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+	if(page == MAP_FAILED) {
+		fprintf(stderr, "Could not share the spectrum at %s: %s\n", sa->name, strerror(errno));
+		if(fd >= 0) shm_unlink(sa->name);
+		return -1;
+	}
+	sa->page = page;
+	sa->shared = true;
+	return 0;
+}
+
+// Windowed (Hann, half overlapped) FFTs of the tapped blocks, averaged and published to /dev/shm/fm95.spectrum[.<station>]
+int init_spectrum_analyzer(SpectrumAnalyzer* sa, const char* station, uint32_t fft_size, uint32_t sample_rate, size_t block_size) {
+	memset(sa, 0, sizeof(SpectrumAnalyzer));
+	if(fft_size < SPECTRUM_MIN_SIZE || fft_size > SPECTRUM_MAX_SIZE || (fft_size & (fft_size - 1)) != 0) {
+		fprintf(stderr, "Spectrum size has to be a power of two from %d to %d\n", SPECTRUM_MIN_SIZE, SPECTRUM_MAX_SIZE);
+		return -1;
+	}
+	if(station == NULL || station[0] == '\0') snprintf(sa->name, sizeof(sa->name), SPECTRUM_NAME_PREFIX);
+	else snprintf(sa->name, sizeof(sa->name), SPECTRUM_NAME_PREFIX ".%s", station);
+
+	uint32_t bins = fft_size / 2 + 1;
+	sa->fft_size = fft_size;
+	sa->hop = fft_size / 2;
+	sa->page_size = sizeof(SpectrumPage) + bins * sizeof(float);
+	if(map_page(sa) != 0) return -1;
+
+	sa->tap.block_size = block_size;
+	sa->tap.slots = malloc(SPECTRUM_TAP_SLOTS * block_size * sizeof(float));
+	sa->window = malloc(fft_size * sizeof(float));
+	sa->pending = malloc(fft_size * sizeof(float));
+	sa->average = calloc(bins, sizeof(float));
+	sa->fft_in = malloc(fft_size * sizeof(float complex));
+	sa->fft_out = malloc(fft_size * sizeof(float complex));
+	if(!sa->tap.slots || !sa->window || !sa->pending || !sa->average || !sa->fft_in || !sa->fft_out) {
+		exit_spectrum_analyzer(sa);
+		return -1;
+	}
+	sa->plan = fft_create_plan(fft_size, sa->fft_in, sa->fft_out, LIQUID_FFT_FORWARD, 0);
+
+	float window_sum = 0.0f;
+	for(uint32_t i = 0; i < fft_size; i++) {
+		sa->window[i] = 0.5f - 0.5f * cosf(M_2PI * i / fft_size);
+		window_sum += sa->window[i];
+	}
+	sa->scale = 4.0f / (window_sum * window_sum); // a full scale sine peaks at 0 dB
+	sa->alpha = 1.0f - expf(-(float)sa->hop / (sample_rate * SPECTRUM_AVERAGING));
+
+	memset(sa->page, 0, sa->page_size);
+	sa->page->size = sa->page_size;
+	sa->page->fft_size = fft_size;
+	sa->page->bins = bins;
+	sa->page->sample_rate = sample_rate;
+	sa->page->bin_hz = (float)sample_rate / fft_size;
+	sa->page->averaging = SPECTRUM_AVERAGING;
+	for(uint32_t i = 0; i < bins; i++) sa->page->power_db[i] = -200.0f;
+	sa->page->version = SPECTRUM_VERSION;
+	atomic_thread_fence(memory_order_release);
+	sa->page->magic = SPECTRUM_MAGIC;
+
+	sa->running = true;
+	if(pthread_create(&sa->thread, NULL, spectrum_thread, sa) != 0) {
+		sa->running = false;
+		exit_spectrum_analyzer(sa);
+		return -1;
+	}
+	return 0;
+}
+
+void exit_spectrum_analyzer(SpectrumAnalyzer* sa) {
+	if(sa->running) {
+		sa->running = false;
+		pthread_join(sa->thread, NULL);
+	}
+	if(sa->plan != NULL) fft_destroy_plan(sa->plan);
+	free(sa->tap.slots);
+	free(sa->window);
+	free(sa->pending);
+	free(sa->average);
+	free(sa->fft_in);
+	free(sa->fft_out);
+	if(sa->page != NULL) {
+		sa->page->magic = 0;
+		munmap(sa->page, sa->page_size);
+		if(sa->shared) shm_unlink(sa->name);
+	}
+	memset(sa, 0, sizeof(SpectrumAnalyzer));
+}
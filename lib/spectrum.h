@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <complex.h>
+#include <pthread.h>
+#include <liquid/liquid.h>
+
+#define SPECTRUM_MAGIC 0x43455053u // "SPEC"
+#define SPECTRUM_VERSION 1
+#define SPECTRUM_NAME_PREFIX "/fm95.spectrum"
+#define SPECTRUM_MIN_SIZE 256
+#define SPECTRUM_MAX_SIZE 65536
+#define SPECTRUM_TAP_SLOTS 4
+#define SPECTRUM_AVERAGING 1.0f // seconds
+
+// Single producer, single consumer ring of whole blocks, the producer drops instead of waiting
+typedef struct {
+	float* slots;
+	size_t block_size;
+	_Alignas(64) atomic_size_t head;
+	_Alignas(64) atomic_size_t tail;
+	uint64_t dropped; // only the producer writes it
+} BlockTap;
+
+// The shared page, readers mmap it read-only, power_db has bins entries
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // of the whole page
+	uint32_t fft_size;
+	uint32_t bins; // fft_size / 2 + 1, DC to Nyquist
+	uint32_t sample_rate;
+	float bin_hz;
+	float averaging;
+	_Alignas(64) atomic_uint seq; // odd while the analyzer is inside
+	uint64_t frames; // FFT frames averaged since start
+	uint64_t dropped; // blocks the analyzer was too slow for
+	_Alignas(64) float power_db[]; // dBFS, a full scale sine is 0
+} SpectrumPage;
+
+typedef struct {
+	BlockTap tap;
+	pthread_t thread;
+	volatile bool running;
+
+	// Only the analyzer thread touches these
+	uint32_t fft_size;
+	uint32_t hop;
+	float* window;
+	float scale;
+	float alpha;
+	float* pending;
+	size_t pending_len;
+	float complex* fft_in;
+	float complex* fft_out;
+	fftplan plan;
+	float* average;
+	uint64_t frames;
+
+	SpectrumPage* page;
+	size_t page_size;
+	char name[64];
+	bool shared;
+} SpectrumAnalyzer;
+
+int init_spectrum_analyzer(SpectrumAnalyzer* sa, const char* station, uint32_t fft_size, uint32_t sample_rate, size_t block_size);
+void exit_spectrum_analyzer(SpectrumAnalyzer* sa);
+
+// Called by the DSP thread, one memcpy and no syscalls, false when the block was dropped
+static inline bool tap_block(BlockTap* tap, const float* block) {
+	size_t head = atomic_load_explicit(&tap->head, memory_order_relaxed);
+	size_t tail = atomic_load_explicit(&tap->tail, memory_order_acquire);
+	if(head - tail >= SPECTRUM_TAP_SLOTS) {
+		tap->dropped++;
+		return false;
+	}
+	memcpy(tap->slots + (head % SPECTRUM_TAP_SLOTS) * tap->block_size, block, tap->block_size * sizeof(float));
+	atomic_store_explicit(&tap->head, head + 1, memory_order_release);
+	return true;
+}
+
+// Lock-free snapshot for readers, out needs page->bins floats
+static inline bool read_spectrum(const SpectrumPage* page, float* out) {
+	if(page->magic != SPECTRUM_MAGIC || page->version != SPECTRUM_VERSION) return false;
+	unsigned int s1, s2;
+	do {
+		s1 = atomic_load_explicit((atomic_uint*)&page->seq, memory_order_acquire);
+		if(s1 & 1) continue;
+		memcpy(out, (const void*)page->power_db, page->bins * sizeof(float));
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit((atomic_uint*)&page->seq, memory_order_relaxed);
+		if(s1 == s2) break;
+	} while(1);
+	return true;
+}
@@ -13,6 +13,11 @@ void init_stereo_encoder(StereoEncoder* st, uint8_t stereo_ssb, uint8_t multipli
     } else st->stereo_hilbert = NULL;
 }
 
+// Same scale as init takes, for when the share of the audio changes while running
+void set_stereo_audio_volume(StereoEncoder* st, float audio_volume) {
+    st->audio_volume = audio_volume * 0.5f;
+}
+
 float stereo_encode(StereoEncoder* st, uint8_t enabled, float left, float right, float *audio) {
     float mid = (left+right) * 0.5f;
     if(!enabled) {
@@ -22,10 +27,10 @@ float stereo_encode(StereoEncoder* st, uint8_t enabled, float left, float right,
 
     float side = (left-right) * 0.5f;
     float signalx1 = get_oscillator_sin_multiplier_ni(st->osc, st->multiplier);
-    float signalx2 = get_oscillator_sin_multiplier_ni(st->osc, st->multiplier * 2.0f);
+    float signalx2 = get_oscillator_sin_multiplier_ni(st->osc, st->multiplier * 2);
     if(st->stereo_hilbert) {
         float complex stereo_hilbert = 0+0*I;
-        float signalx2cos = get_oscillator_cos_multiplier_ni(st->osc, st->multiplier * 2.0f);
+        float signalx2cos = get_oscillator_cos_multiplier_ni(st->osc, st->multiplier * 2);
 
         mid = delay_line(&st->delay, mid);
         *audio = mid * st->audio_volume;
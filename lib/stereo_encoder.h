@@ -18,5 +18,6 @@ typedef struct
 } StereoEncoder;
 
 void init_stereo_encoder(StereoEncoder *st, uint8_t stereo_ssb, uint8_t multiplier, Oscillator *osc, float audio_volume, float pilot_volume);
+void set_stereo_audio_volume(StereoEncoder* st, float audio_volume);
 float stereo_encode(StereoEncoder* st, uint8_t enabled, float left, float right, float *audio);
 void exit_stereo_encoder(StereoEncoder* st);
\ No newline at end of file
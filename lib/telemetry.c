@@ -0,0 +1,56 @@
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// One page at /dev/shm/fm95 (or fm95.<station>), any number of monitors can mmap it
+int init_telemetry(Telemetry* t, const char* station) {
+	memset(t, 0, sizeof(Telemetry));
+	if(station == NULL || station[0] == '\0') snprintf(t->name, sizeof(t->name), TELEMETRY_NAME_PREFIX);
+	else snprintf(t->name, sizeof(t->name), TELEMETRY_NAME_PREFIX ".%s", station);
+
+	void* page = MAP_FAILED;
+	int fd = shm_open(t->name, O_CREAT | O_RDWR, 0644);
+	if(fd >= 0) {
+		if(ftruncate(fd, sizeof(TelemetryPage)) == 0) page = mmap(NULL, sizeof(TelemetryPage), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		close(fd);
+	}
+	if(page == MAP_FAILED) {
+		fprintf(stderr, "Could not share telemetry at %s: %s, it is still served over the socket\n", t->name, strerror(errno));
+		if(fd >= 0) shm_unlink(t->name);
+		page = mmap(NULL, sizeof(TelemetryPage), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if(page == MAP_FAILED) return -1;
+	} else t->shared = true;
+
+	t->page = page;
+	memset(t->page, 0, sizeof(TelemetryPage));
+	t->page->size = sizeof(TelemetryPage);
+	t->page->pid = getpid();
+	t->page->version = TELEMETRY_VERSION;
+	atomic_thread_fence(memory_order_release);
+	t->page->magic = TELEMETRY_MAGIC; // last, so a reader never trusts a half made page
+	return 0;
+}
+
+// Single writer, so the sequence needs no read-modify-write
+void publish_telemetry(Telemetry* t, const TelemetryData* data) {
+	if(t->page == NULL) return;
+	unsigned int seq = atomic_load_explicit(&t->page->seq, memory_order_relaxed);
+	atomic_store_explicit(&t->page->seq, seq + 1, memory_order_relaxed);
+	atomic_thread_fence(memory_order_release);
+	memcpy(&t->page->data, data, sizeof(TelemetryData));
+	atomic_store_explicit(&t->page->seq, seq + 2, memory_order_release);
+}
+
+void exit_telemetry(Telemetry* t) {
+	if(t->page == NULL) return;
+	t->page->magic = 0;
+	munmap(t->page, sizeof(TelemetryPage));
+	if(t->shared) shm_unlink(t->name);
+	t->page = NULL;
+}
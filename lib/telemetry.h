@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#define TELEMETRY_MAGIC 0x35394d46u // "FM95"
+#define TELEMETRY_VERSION 1
+#define TELEMETRY_NAME_PREFIX "/fm95"
+
+// What fm95 measured over one block, block values are peaks unless said otherwise
+typedef struct {
+	uint64_t blocks; // blocks processed since start, wraps never in practice
+	uint64_t samples;
+	int64_t time_ns; // CLOCK_REALTIME at the end of the block
+	uint32_t sample_rate;
+	uint32_t block_size;
+
+	float mpx_power; // dBr, as the BS412 compressor sees it at the end of the block
+	float bs412_gain;
+	float agc_gain; // at the end of the block, 0 when the AGC is off
+	float input_level; // peak of the input, after the preamp
+	float audio_level; // peak of the clipped audio
+	float output_level; // peak of the composite, before the master volume
+	float input_sample; // the block's last input sample, (|l| + |r|) / 2, what command 0xff calls input_level
+	float audio_sample; // the block's last clipped audio sample, signed (l + r) / 2, what command 0xff calls audio_level
+
+	uint8_t stereo;
+	uint8_t rds_streams;
+	uint8_t _pad[6];
+} TelemetryData;
+
+// The shared page, readers mmap it read-only and never write to it
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size; // of this struct, for readers built against another version
+	uint32_t pid;
+	_Alignas(64) atomic_uint seq; // odd while the writer is inside
+	_Alignas(64) TelemetryData data;
+} TelemetryPage;
+
+typedef struct {
+	TelemetryPage* page;
+	char name[64];
+	bool shared; // false when shm was not available and the page is private
+} Telemetry;
+
+int init_telemetry(Telemetry* t, const char* station);
+void publish_telemetry(Telemetry* t, const TelemetryData* data);
+void exit_telemetry(Telemetry* t);
+
+// Lock-free snapshot for readers, returns false when the page is not a telemetry page
+static inline bool read_telemetry(const TelemetryPage* page, TelemetryData* out) {
+	if(page->magic != TELEMETRY_MAGIC || page->version != TELEMETRY_VERSION) return false;
+	unsigned int s1, s2;
+	do {
+		s1 = atomic_load_explicit((atomic_uint*)&page->seq, memory_order_acquire);
+		if(s1 & 1) continue;
+		memcpy(out, (const void*)&page->data, sizeof(TelemetryData));
+		atomic_thread_fence(memory_order_acquire);
+		s2 = atomic_load_explicit((atomic_uint*)&page->seq, memory_order_relaxed);
+		if(s1 == s2) break;
+	} while(1);
+	return true;
+}
@@ -0,0 +1,248 @@
+#define _GNU_SOURCE
+#include "vban_input.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sched.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "vban.h"
+
+#define RECV_BATCH 32
+#define RECV_TIMEOUT_MS 250 // only so that the thread notices when it should stop
+#define RESAMPLED_FRAMES 4096
+
+#define DRIFT_KP 0.028
+#define DRIFT_KI 4e-4
+#define DRIFT_SMOOTHING 2.0
+
+bool is_vban_input(const char* device) {
+	return strncmp(device, VBAN_INPUT_PREFIX, strlen(VBAN_INPUT_PREFIX)) == 0;
+}
+
+// vban://[sender][:port]/stream, no sender takes the stream from anyone
+static int parse_vban_url(VBANInput* in, const char* url, int* port) {
+	char host[64] = "";
+	const char* p = url + strlen(VBAN_INPUT_PREFIX);
+	const char* slash = strchr(p, '/');
+	if(slash == NULL || slash[1] == '\0' || strlen(slash + 1) > sizeof(((VBANHeader*)0)->streamname)) return -1;
+	strcpy(in->stream_name, slash + 1);
+
+	size_t host_len = slash - p;
+	if(host_len >= sizeof(host)) return -1;
+	memcpy(host, p, host_len);
+	host[host_len] = '\0';
+
+	*port = VBAN_DEFAULT_PORT;
+	char* colon = strchr(host, ':');
+	if(colon != NULL) {
+		*colon = '\0';
+		*port = atoi(colon + 1);
+	}
+	if(host[0] == '\0') strcpy(host, "0.0.0.0");
+	return (inet_pton(AF_INET, host, &in->remote) == 1) ? 0 : -1;
+}
+
+static void* vban_input_thread(void* arg) {
+	VBANInput* in = arg;
+	char buffers[RECV_BATCH][1500];
+	struct sockaddr_in sender_addrs[RECV_BATCH];
+	struct iovec iovecs[RECV_BATCH];
+	struct mmsghdr msgs[RECV_BATCH];
+	memset(msgs, 0, sizeof(msgs));
+	for(int i = 0; i < RECV_BATCH; i++) {
+		iovecs[i].iov_base = buffers[i];
+		iovecs[i].iov_len = sizeof(buffers[i]);
+		msgs[i].msg_hdr.msg_iov = &iovecs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		msgs[i].msg_hdr.msg_name = &sender_addrs[i];
+	}
+
+	uint8_t last_sr = 0xff, last_format = 0xff, last_channels = 0;
+	while(in->running) {
+		for(int i = 0; i < RECV_BATCH; i++) msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+		// Blocks for the first one, then takes whatever else is already queued
+		int received = recvmmsg(in->sockfd, msgs, RECV_BATCH, MSG_WAITFORONE, NULL);
+		if(received < 0) {
+			if(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+			perror("recvmmsg");
+			break;
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		double arrival = now.tv_sec + now.tv_nsec / 1e9;
+
+		pthread_mutex_lock(&in->lock);
+		for(int m = 0; m < received; m++) {
+			VBANHeader header;
+			if(parse_vban_header(buffers[m], msgs[m].msg_len, &header) != VBAN_PROTOCOL_AUDIO) continue;
+			if(strncmp(header.streamname, in->stream_name, sizeof(header.streamname)) != 0) continue;
+			if(sender_addrs[m].sin_addr.s_addr != in->remote.s_addr && in->remote.s_addr != 0) continue;
+
+			uint8_t sr_idx = header.protocol_sample_rate_idx & 0x1f;
+			if(sr_idx >= VBAN_SR_MAXNUMBER || header.format_type >= VBAN_BIT_MAXNUMBER) continue;
+			if(sr_idx != last_sr || header.format_type != last_format || header.sample_channels != last_channels) {
+				last_sr = sr_idx;
+				last_format = header.format_type;
+				last_channels = header.sample_channels;
+				printf("VBAN input %s: %ld Hz, %s, %d channels\n", in->stream_name, VBAN_SRList[sr_idx], VBAN_TextBITList[last_format], last_channels + 1);
+
+				in->sr_idx = sr_idx;
+				in->format = last_format;
+				in->channels = last_channels;
+				in->reconfigure = true;
+				reset_jitter_buffer(&in->jitter, last_format);
+			}
+
+			in->packet_duration = (header.samples_per_frame + 1) / (double)VBAN_SRList[sr_idx];
+			push_jitter_buffer(&in->jitter, header.frame_num, buffers[m] + sizeof(VBANHeader), msgs[m].msg_len - sizeof(VBANHeader), arrival, in->packet_duration);
+		}
+		pthread_mutex_unlock(&in->lock);
+	}
+	return NULL;
+}
+
+int init_vban_input(VBANInput* in, const char* url, uint32_t out_rate, uint8_t out_channels, uint8_t min_depth, uint8_t max_depth) {
+	memset(in, 0, sizeof(VBANInput));
+	in->sockfd = -1;
+
+	int port;
+	if(parse_vban_url(in, url, &port) != 0) {
+		fprintf(stderr, "Invalid VBAN input, expected vban://[sender][:port]/stream: %s\n", url);
+		return -1;
+	}
+
+	in->out_rate = out_rate;
+	in->out_channels = out_channels;
+	in->decoded = malloc(JITTER_MAX_PAYLOAD * sizeof(float));
+	in->remapped = malloc(JITTER_MAX_PAYLOAD * out_channels * sizeof(float));
+	in->resampled = malloc(RESAMPLED_FRAMES * out_channels * sizeof(float));
+	if(in->decoded == NULL || in->remapped == NULL || in->resampled == NULL || init_asrc(&in->asrc, out_channels) != 0) {
+		exit_vban_input(in);
+		return -1;
+	}
+	init_drift_estimator(&in->drift, DRIFT_KP, DRIFT_KI, DRIFT_SMOOTHING);
+	init_jitter_buffer(&in->jitter, min_depth, max_depth);
+	in->jitter.rate_controlled = true; // the resampler takes care of small offsets
+	pthread_mutex_init(&in->lock, NULL);
+
+	in->sockfd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if(in->sockfd < 0) {
+		perror("socket");
+		exit_vban_input(in);
+		return -1;
+	}
+	struct timeval timeout = {.tv_sec = 0, .tv_usec = RECV_TIMEOUT_MS * 1000};
+	setsockopt(in->sockfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	struct sockaddr_in local_addr;
+	memset(&local_addr, 0, sizeof(local_addr));
+	local_addr.sin_family = AF_INET;
+	local_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	local_addr.sin_port = htons(port);
+	if(bind(in->sockfd, (struct sockaddr*)&local_addr, sizeof(local_addr)) < 0) {
+		perror("bind");
+		exit_vban_input(in);
+		return -1;
+	}
+
+	// Any core but not the caller's, a pinned DSP thread and the receiver must not take turns on one core
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	cpu_set_t cpus;
+	CPU_ZERO(&cpus);
+	long cpu_count = sysconf(_SC_NPROCESSORS_CONF);
+	for(long i = 0; i < cpu_count && i < CPU_SETSIZE; i++) CPU_SET(i, &cpus);
+	pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+
+	in->running = true;
+	int err = pthread_create(&in->thread, &attr, vban_input_thread, in);
+	if(err == EINVAL) err = pthread_create(&in->thread, NULL, vban_input_thread, in); // the mask was refused
+	pthread_attr_destroy(&attr);
+	if(err != 0) {
+		in->running = false;
+		fprintf(stderr, "pthread_create: %s\n", strerror(err));
+		exit_vban_input(in);
+		return -1;
+	}
+	return 0;
+}
+
+// Takes the next packet out of the jitter buffer and turns it into frames at our rate and channel count, false if there is nothing
+static bool next_vban_packet(VBANInput* in) {
+	pthread_mutex_lock(&in->lock);
+	if(in->reconfigure) {
+		in->reconfigure = false;
+		init_channel_map(&in->map, in->channels + 1, in->out_channels, NULL);
+		set_asrc_nominal(&in->asrc, (double)VBAN_SRList[in->sr_idx] / in->out_rate);
+		init_drift_estimator(&in->drift, DRIFT_KP, DRIFT_KI, DRIFT_SMOOTHING);
+	}
+
+	double fill = jitter_buffer_fill(&in->jitter) * in->packet_duration;
+	bool playing = in->jitter.playing;
+	size_t size = pop_jitter_buffer(&in->jitter, in->raw);
+	if(size == 0 || in->map.in_channels == 0) {
+		pthread_mutex_unlock(&in->lock);
+		return false;
+	}
+
+	uint8_t format = in->format;
+	size_t frames = size / sample_format_bytes[format] / in->map.in_channels;
+	double dt = frames / (double)VBAN_SRList[in->sr_idx];
+	double target = in->jitter.target_depth * in->packet_duration;
+	if(playing) set_asrc_ratio(&in->asrc, update_drift_estimator(&in->drift, fill, target, dt));
+	pthread_mutex_unlock(&in->lock);
+
+	decode_samples(in->raw, in->decoded, frames * in->map.in_channels, format);
+	remap_channels(&in->map, in->decoded, in->remapped, frames);
+	in->remapped_frames = frames;
+	in->remapped_pos = 0;
+	return true;
+}
+
+// Never blocks, what the network didn't deliver in time comes out as concealment or silence
+void read_vban_input(VBANInput* in, float* out, size_t frames) {
+	uint8_t oc = in->out_channels;
+	size_t done = 0;
+	while(done < frames) {
+		if(in->resampled_pos < in->resampled_frames) {
+			size_t n = in->resampled_frames - in->resampled_pos;
+			if(n > frames - done) n = frames - done;
+			memcpy(out + done * oc, in->resampled + in->resampled_pos * oc, n * oc * sizeof(float));
+			in->resampled_pos += n;
+			done += n;
+			continue;
+		}
+
+		if(in->remapped_pos >= in->remapped_frames && !next_vban_packet(in)) {
+			memset(out + done * oc, 0, (frames - done) * oc * sizeof(float));
+			return;
+		}
+
+		size_t piece = (size_t)((RESAMPLED_FRAMES - 4) * in->asrc.ratio);
+		if(piece == 0) piece = 1;
+		if(piece > in->remapped_frames - in->remapped_pos) piece = in->remapped_frames - in->remapped_pos;
+		in->resampled_frames = process_asrc(&in->asrc, in->remapped + in->remapped_pos * oc, piece, in->resampled, RESAMPLED_FRAMES);
+		in->resampled_pos = 0;
+		in->remapped_pos += piece;
+	}
+}
+
+void exit_vban_input(VBANInput* in) {
+	if(in->running) {
+		in->running = false;
+		pthread_join(in->thread, NULL);
+	}
+	if(in->sockfd >= 0) close(in->sockfd);
+	in->sockfd = -1;
+	exit_asrc(&in->asrc);
+	free(in->decoded);
+	free(in->remapped);
+	free(in->resampled);
+	in->decoded = in->remapped = in->resampled = NULL;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include "jitter_buffer.h"
+#include "sample_format.h"
+#include "asrc.h"
+
+#define VBAN_INPUT_PREFIX "vban://"
+#define VBAN_DEFAULT_PORT 6980
+
+// A VBAN stream received on its own thread and pulled as float frames at our rate, for when it is the input of a processing loop
+typedef struct {
+	int sockfd;
+	struct in_addr remote;
+	char stream_name[17];
+	pthread_t thread;
+	volatile bool running;
+
+	pthread_mutex_t lock;
+	JitterBuffer jitter;
+	bool reconfigure;
+	uint8_t sr_idx;
+	uint8_t format;
+	uint8_t channels;
+	double packet_duration;
+
+	// Only the reader touches these
+	uint32_t out_rate;
+	uint8_t out_channels;
+	ChannelMap map;
+	Asrc asrc;
+	DriftEstimator drift;
+	uint8_t raw[JITTER_MAX_PAYLOAD];
+	float* decoded;
+	float* remapped;
+	size_t remapped_frames, remapped_pos;
+	float* resampled;
+	size_t resampled_frames, resampled_pos;
+} VBANInput;
+
+bool is_vban_input(const char* device);
+int init_vban_input(VBANInput* in, const char* url, uint32_t out_rate, uint8_t out_channels, uint8_t min_depth, uint8_t max_depth);
+void read_vban_input(VBANInput* in, float* out, size_t frames);
+void exit_vban_input(VBANInput* in);
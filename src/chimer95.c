@@ -4,6 +4,9 @@
 #include <signal.h>
 #include <string.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
 #include "ini.h"
 
 #define DEFAULT_CONFIG_PATH "/etc/chimer95.conf"
@@ -12,6 +15,7 @@
 #define buffer_prebuf 0
 
 #include "oscillator.h"
+#include "clip.h"
 
 #define DEFAULT_FREQ 1000.0f
 #define DEFAULT_SAMPLE_RATE 8000
@@ -29,16 +33,18 @@
 #define PIP_PAUSE 900
 #define BEEP_DURATION 500
 
+#define WAKEUP_LEAD_NS 500000000 // Wake up this much before a sequence to measure the latency and line up the start
+
 #define SEQ_NONE 0
 #define SEQ_29_56 1
 #define SEQ_59_55 2
 #define SEQ_TEST_HOUR 3
+#define SEQ_CLIP 4
+
+#define MAX_CLIPS 16
+#define DEFAULT_CACHE_DIR "/var/cache/chimer95"
 
 volatile sig_atomic_t to_run = 1;
-volatile sig_atomic_t playing_sequence = 0;
-volatile int sequence_position = 0;
-volatile int sequence_type = SEQ_NONE;
-volatile time_t last_sequence_time = 0;
 
 static void stop(int signum) {
 	(void)signum;
@@ -55,50 +61,17 @@ void show_help(char *name) {
 	);
 }
 
-void generate_signal(float *output, Oscillator *osc, float volume, int *elapsed_samples, int total_samples, int pip_samples, int pause_samples, int beep_samples, int num_pips) {
-	for (int i = 0; i < BUFFER_SIZE; i++) {
-		if (*elapsed_samples >= total_samples) {
-			output[i] = 0;
-			playing_sequence = 0;
-		} else {
-			int cycle_position = *elapsed_samples;
-			int pip_cycle = pip_samples + pause_samples;
-
-			if (cycle_position < num_pips * pip_cycle) {
-				if ((cycle_position % pip_cycle) < pip_samples) output[i] = get_oscillator_sin_sample(osc) * volume;
-				else output[i] = 0;
-			} else if (cycle_position < num_pips * pip_cycle + beep_samples) output[i] = get_oscillator_sin_sample(osc) * volume;
-			else output[i] = 0;
-
-			(*elapsed_samples)++;
-		}
-	}
-}
-
-int check_time_for_sequence(int test_mode, int16_t offset) {
-	static time_t last_check = 0;
-	static int last_minute = -1;
-
-	time_t now = time(NULL);
-	if (now == last_check) return SEQ_NONE;
-
-	last_check = now;
-	struct tm *utc_time = gmtime(&now);
-	int minute = utc_time->tm_min;
-	int second = utc_time->tm_sec;
-
-	if (difftime(now, last_sequence_time) < 1.0) return SEQ_NONE;
-
-	last_sequence_time = now;
-	if (minute == 29 && second == (56 + offset)) return SEQ_29_56;
-	if (minute == 59 && second == (55 + offset)) return SEQ_59_55;
-	if (test_mode && second == (55 + offset) && minute != last_minute) {
-		last_minute = minute;
-		return SEQ_TEST_HOUR;
-	}
-
-	return SEQ_NONE;
-}
+typedef struct {
+	char name[32];
+	char file[128];
+	float volume;
+	// Cron like masks of when to play, bit n set means the n-th second/minute/hour/weekday matches
+	uint64_t seconds;
+	uint64_t minutes;
+	uint32_t hours;
+	uint8_t weekdays;
+	bool localtime;
+} Chimer95_Clip;
 
 typedef struct
 {
@@ -107,6 +80,11 @@ typedef struct
 	uint32_t sample_rate;
 	int16_t offset;
 	bool test_mode;
+	bool gts;
+
+	Chimer95_Clip clips[MAX_CLIPS];
+	uint8_t clip_count;
+	char cache_dir[128];
 
 	char ini_config_path[64];
 } Chimer95_Config;
@@ -115,6 +93,11 @@ typedef struct
 	PulseOutputDevice output_device;
 } Chimer95_Runtime;
 
+typedef struct {
+	const float* samples;
+	size_t length;
+} Chimer95_Sequence;
+
 typedef struct {
     char output[64];
 } Chimer95_DeviceNames;
@@ -123,75 +106,241 @@ typedef struct {
     Chimer95_DeviceNames* devices;
 } Chimer95_SetupContext;
 
-int run_chimer95(const Chimer95_Config config, Chimer95_Runtime* runtime) {
-	int pulse_error;
-
+static int render_sequence(Chimer95_Sequence* seq, const Chimer95_Config config, int num_pips) {
 	Oscillator osc;
 	init_oscillator(&osc, config.freq, config.sample_rate);
 
-	float output[BUFFER_SIZE];
+	size_t pip_samples = (size_t)((PIP_DURATION / 1000.0) * config.sample_rate);
+	size_t pip_cycle = pip_samples + (size_t)((PIP_PAUSE / 1000.0) * config.sample_rate);
+	size_t beep_samples = (size_t)((BEEP_DURATION / 1000.0) * config.sample_rate);
 
-	int pip_samples = (int)((PIP_DURATION / 1000.0) * config.sample_rate);
-	int pause_samples = (int)((PIP_PAUSE / 1000.0) * config.sample_rate);
-	int beep_samples = (int)((BEEP_DURATION / 1000.0) * config.sample_rate);
+	seq->length = num_pips * pip_cycle + beep_samples;
+	float* samples = calloc(seq->length, sizeof(float));
+	if(samples == NULL) return 1;
 
-	int samples_29_56 = 4 * (pip_samples + pause_samples) + beep_samples;
-	int samples_59_55 = 5 * (pip_samples + pause_samples) + beep_samples;
+	for(size_t i = 0; i < seq->length; i++) {
+		if(i >= num_pips * pip_cycle || (i % pip_cycle) < pip_samples) samples[i] = get_oscillator_sin_sample(&osc) * config.master_volume;
+	}
+	seq->samples = samples;
+	return 0;
+}
 
-	printf("Ready to play time signals.\n");
-	printf("Will trigger at XX:29:%02d and XX:59:%02d\n", 56+config.offset, 55+config.offset);
-	if (config.test_mode) printf("TEST MODE: Will also play full hour signal at the end of every minute\n");
+// Finds the first sequence strictly after the given time
+static time_t next_sequence_time(time_t after, const Chimer95_Config config, int* type) {
+	time_t hour = after - (after % 3600);
+	time_t best = 0;
+
+	for(time_t base = hour - 3600; base <= hour + 3600; base += 3600) {
+		for(int minute = 0; minute < 60; minute++) {
+			int candidate_type = SEQ_NONE;
+			time_t candidate;
+			if(minute == 29) {
+				candidate = base + minute * 60 + 56 + config.offset;
+				candidate_type = SEQ_29_56;
+			} else {
+				candidate = base + minute * 60 + 55 + config.offset;
+				if(minute == 59) candidate_type = SEQ_59_55;
+				else if(config.test_mode) candidate_type = SEQ_TEST_HOUR;
+			}
+			if(candidate_type == SEQ_NONE || candidate <= after) continue;
+			if(best == 0 || candidate < best) {
+				best = candidate;
+				*type = candidate_type;
+			}
+		}
+	}
+	return best;
+}
 
-	int elapsed_samples = 0;
-	int total_sequence_samples = 0;
-	int sequence_completed = 0;
+// Finds the first time strictly after the given one matching the clip's schedule, 0 if there is none within a week
+static time_t next_clip_time(time_t after, const Chimer95_Clip* clip) {
+	time_t minute = after - (after % 60);
+	for(int i = 0; i <= 8 * 24 * 60; i++, minute += 60) {
+		struct tm tm;
+		if(clip->localtime) localtime_r(&minute, &tm);
+		else gmtime_r(&minute, &tm);
+
+		if(!(clip->hours & (1u << tm.tm_hour)) || !(clip->minutes & (1ULL << tm.tm_min)) || !(clip->weekdays & (1u << tm.tm_wday))) continue;
+		for(int second = 0; second < 60; second++) {
+			if((clip->seconds & (1ULL << second)) && minute + second > after) return minute + second;
+		}
+	}
+	return 0;
+}
 
-	while (to_run) {
-		if (!playing_sequence) {
-			int new_sequence = check_time_for_sequence(config.test_mode, config.offset);
+// Parses one cron field: "*", "5", "1,2,3", "0-10", "*/15" or "0-30/5"
+static int parse_cron_field(const char* field, int max, uint64_t* mask) {
+	*mask = 0;
+	char buf[64];
+	strncpy(buf, field, sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = '\0';
+
+	char* saveptr;
+	for(char* item = strtok_r(buf, ",", &saveptr); item != NULL; item = strtok_r(NULL, ",", &saveptr)) {
+		int lo = 0, hi = max - 1, step = 1;
+		char* slash = strchr(item, '/');
+		if(slash != NULL) {
+			*slash = '\0';
+			step = atoi(slash + 1);
+			if(step <= 0) return -1;
+		}
+		if(strcmp(item, "*") != 0) {
+			char* dash = strchr(item, '-');
+			lo = atoi(item);
+			hi = (dash != NULL) ? atoi(dash + 1) : ((slash != NULL) ? max - 1 : lo);
+		}
+		if(lo < 0 || hi >= max || lo > hi) return -1;
+		for(int v = lo; v <= hi; v += step) *mask |= 1ULL << v;
+	}
+	return (*mask != 0) ? 0 : -1;
+}
 
-			if (new_sequence != SEQ_NONE) {
-				playing_sequence = 1;
-				sequence_type = new_sequence;
-				elapsed_samples = 0;
-				sequence_completed = 0;
+// "second minute hour [weekday]"
+static int parse_schedule(Chimer95_Clip* clip, const char* value) {
+	char fields[4][64] = {"", "", "", "*"};
+	int n = sscanf(value, "%63s %63s %63s %63s", fields[0], fields[1], fields[2], fields[3]);
+	if(n < 3) return -1;
+
+	uint64_t hours, weekdays;
+	if(parse_cron_field(fields[0], 60, &clip->seconds) != 0) return -1;
+	if(parse_cron_field(fields[1], 60, &clip->minutes) != 0) return -1;
+	if(parse_cron_field(fields[2], 24, &hours) != 0) return -1;
+	if(parse_cron_field(fields[3], 7, &weekdays) != 0) return -1;
+	clip->hours = (uint32_t)hours;
+	clip->weekdays = (uint8_t)weekdays;
+	return 0;
+}
 
-				if (new_sequence == SEQ_29_56) total_sequence_samples = samples_29_56;
-				else total_sequence_samples = samples_59_55;
+static int write_silence(Chimer95_Runtime* runtime, size_t samples) {
+	static const float silence[BUFFER_SIZE] = {0};
+	while(samples > 0 && to_run) {
+		size_t n = samples > BUFFER_SIZE ? BUFFER_SIZE : samples;
+		int pulse_error = write_PulseOutputDevice(&runtime->output_device, (void*)silence, n * sizeof(float));
+		if(pulse_error) return pulse_error;
+		samples -= n;
+	}
+	return 0;
+}
 
-				memset(output, 0, sizeof(output));
-			} else {
-				static int idle_counter = 0;
-				if (idle_counter++ % 10 == 0) {
-					memset(output, 0, sizeof(output));
-					if((pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(output)))) {
-						fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
-						to_run = 0;
-						break;
-					}
-				}
-
-				struct timespec ts = {0, 5000000}; // 5ms sleep
-				nanosleep(&ts, NULL);
-				continue;
+static int play_sequence(Chimer95_Runtime* runtime, const Chimer95_Sequence* seq, size_t skip) {
+	for(size_t i = skip; i < seq->length && to_run; i += BUFFER_SIZE) {
+		size_t n = (seq->length - i) > BUFFER_SIZE ? BUFFER_SIZE : (seq->length - i);
+		int pulse_error = write_PulseOutputDevice(&runtime->output_device, (void*)(seq->samples + i), n * sizeof(float));
+		if(pulse_error) return pulse_error;
+	}
+	return 0;
+}
+
+int run_chimer95(const Chimer95_Config config, Chimer95_Runtime* runtime) {
+	int pulse_error;
+
+	// Everything is rendered once here, between the sequences there is nothing to compute
+	Chimer95_Sequence seq_29_56, seq_59_55;
+	if(render_sequence(&seq_29_56, config, 4) != 0 || render_sequence(&seq_59_55, config, 5) != 0) {
+		fprintf(stderr, "Error: cannot allocate the sequences\n");
+		return 1;
+	}
+
+	// Converted once into the cache, after that they're only mapped
+	Clip clips[MAX_CLIPS];
+	memset(clips, 0, sizeof(clips));
+	for(uint8_t i = 0; i < config.clip_count; i++) {
+		if(load_clip(&clips[i], config.clips[i].file, config.cache_dir, config.sample_rate, config.clips[i].volume) != 0) fprintf(stderr, "Warning: clip %s will not play\n", config.clips[i].name);
+		else printf("Loaded clip %s (%.1f s)\n", config.clips[i].name, (float)clips[i].length / config.sample_rate);
+	}
+
+	int tfd = timerfd_create(CLOCK_REALTIME, TFD_CLOEXEC);
+	if(tfd < 0) {
+		perror("timerfd_create");
+		for(uint8_t i = 0; i < config.clip_count; i++) unload_clip(&clips[i]);
+		free((void*)seq_29_56.samples);
+		free((void*)seq_59_55.samples);
+		return 1;
+	}
+
+	if(config.gts) {
+		printf("Ready to play time signals.\n");
+		printf("Will trigger at XX:29:%02d and XX:59:%02d\n", 56+config.offset, 55+config.offset);
+		if (config.test_mode) printf("TEST MODE: Will also play full hour signal at the end of every minute\n");
+	}
+
+	time_t last_trigger = 0;
+	int ret = 0;
+
+	while (to_run) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+
+		time_t after = now.tv_sec > last_trigger ? now.tv_sec : last_trigger;
+		int type = SEQ_NONE;
+		time_t trigger = config.gts ? next_sequence_time(after, config, &type) : 0;
+
+		int clip_idx = -1;
+		for(uint8_t i = 0; i < config.clip_count; i++) {
+			if(clips[i].samples == NULL) continue;
+			time_t clip_time = next_clip_time(after, &config.clips[i]);
+			if(clip_time != 0 && (trigger == 0 || clip_time < trigger)) {
+				trigger = clip_time;
+				type = SEQ_CLIP;
+				clip_idx = i;
 			}
 		}
+		if(trigger == 0) {
+			printf("Nothing left to play.\n");
+			break;
+		}
+
+		struct itimerspec its = {0};
+		its.it_value.tv_sec = trigger - 1;
+		its.it_value.tv_nsec = 1000000000 - WAKEUP_LEAD_NS;
+		if(timerfd_settime(tfd, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &its, NULL) < 0) {
+			perror("timerfd_settime");
+			ret = 1;
+			break;
+		}
+
+		uint64_t expirations;
+		if(read(tfd, &expirations, sizeof(expirations)) < 0) {
+			if(errno == EINTR || errno == ECANCELED) continue; // Stop signal, or the clock was set and the timer has to be armed again
+			perror("timerfd read");
+			ret = 1;
+			break;
+		}
+
+		if(type == SEQ_CLIP) prefetch_clip(&clips[clip_idx]);
+
+		// Start the sequence so that it leaves the sink right at the trigger time
+		pa_usec_t latency = 0;
+		if((pulse_error = latency_PulseOutputDevice(&runtime->output_device, &latency))) latency = 0;
+		clock_gettime(CLOCK_REALTIME, &now);
 
-		int num_pips = (sequence_type == SEQ_29_56) ? 4 : 5;
-		generate_signal(output, &osc, config.master_volume,
-					   &elapsed_samples, total_sequence_samples,
-					   pip_samples, pause_samples, beep_samples, num_pips);
+		int64_t until_ns = (int64_t)(trigger - now.tv_sec) * 1000000000 - now.tv_nsec - (int64_t)latency * 1000;
+		int64_t delay = until_ns * (int64_t)config.sample_rate / 1000000000;
 
-		if (!playing_sequence && !sequence_completed) sequence_completed = 1;
+		Chimer95_Sequence clip_seq;
+		const Chimer95_Sequence* seq = (type == SEQ_29_56) ? &seq_29_56 : &seq_59_55;
+		if(type == SEQ_CLIP) {
+			clip_seq.samples = clips[clip_idx].samples;
+			clip_seq.length = clips[clip_idx].length;
+			seq = &clip_seq;
+		}
+		last_trigger = trigger;
 
-		if((pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(output)))) {
+		if(delay > 0) pulse_error = write_silence(runtime, (size_t)delay);
+		else pulse_error = 0;
+		if(!pulse_error && -delay < (int64_t)seq->length) pulse_error = play_sequence(runtime, seq, delay < 0 ? (size_t)-delay : 0);
+		if(pulse_error) {
 			fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
-			to_run = 0;
+			ret = 1;
 			break;
 		}
 	}
 
-	return 0;
+	close(tfd);
+	for(uint8_t i = 0; i < config.clip_count; i++) unload_clip(&clips[i]);
+	free((void*)seq_29_56.samples);
+	free((void*)seq_59_55.samples);
+	return ret;
 }
 
 int parse_arguments(int argc, char **argv, Chimer95_Config* config) {
@@ -218,6 +367,34 @@ int parse_arguments(int argc, char **argv, Chimer95_Config* config) {
 	return 0;
 }
 
+static int clip_handler(Chimer95_Config* pconfig, const char* clip_name, const char* name, const char* value) {
+	Chimer95_Clip* clip = NULL;
+	for(uint8_t i = 0; i < pconfig->clip_count; i++) {
+		if(strcmp(pconfig->clips[i].name, clip_name) == 0) clip = &pconfig->clips[i];
+	}
+	if(clip == NULL) {
+		if(pconfig->clip_count >= MAX_CLIPS || strlen(clip_name) >= sizeof(clip->name)) return 0;
+		clip = &pconfig->clips[pconfig->clip_count++];
+		memset(clip, 0, sizeof(Chimer95_Clip));
+		strcpy(clip->name, clip_name);
+		clip->volume = 1.0f;
+	}
+
+	if(strcmp(name, "file") == 0) {
+		strncpy(clip->file, value, sizeof(clip->file) - 1);
+		clip->file[sizeof(clip->file) - 1] = '\0';
+	} else if(strcmp(name, "at") == 0) {
+		if(parse_schedule(clip, value) != 0) {
+			fprintf(stderr, "Invalid schedule of clip %s: %s\n", clip_name, value);
+			return 0;
+		}
+	} else if(strcmp(name, "volume") == 0) clip->volume = strtof(value, NULL);
+	else if(strcmp(name, "localtime") == 0) clip->localtime = atoi(value);
+	else return 0;
+
+	return 1;
+}
+
 static int config_handler(void* user, const char* section, const char* name, const char* value) {
     Chimer95_SetupContext* ctx = (Chimer95_SetupContext*)user;
     Chimer95_Config* pconfig = ctx->config;
@@ -235,9 +412,16 @@ static int config_handler(void* user, const char* section, const char* name, con
 		pconfig->sample_rate = atoi(value);
 	} else if(MATCH("chimer95", "test_mode")) {
 		pconfig->test_mode = atoi(value);
+	} else if(MATCH("chimer95", "gts")) {
+		pconfig->gts = atoi(value);
+	} else if(MATCH("chimer95", "cache")) {
+		strncpy(pconfig->cache_dir, value, sizeof(pconfig->cache_dir) - 1);
+		pconfig->cache_dir[sizeof(pconfig->cache_dir) - 1] = '\0';
 	} else if(MATCH("devices", "chimer")) {
 		strncpy(dv->output, value, 63);
         dv->output[63] = '\0';
+	} else if(strncmp(section, "clip/", 5) == 0) {
+		return clip_handler(pconfig, section + 5, name, value);
 	} else {
         return 0; // Unknown section/name
     }
@@ -254,7 +438,7 @@ int parse_config(Chimer95_Config* config, Chimer95_DeviceNames* dv) {
 }
 
 int main(int argc, char **argv) {
-	printf("chimer95 (GTS time signal encoder by radio95) version 1.3\n");
+	printf("chimer95 (GTS time signal encoder by radio95) version 1.4\n");
 
 
 	Chimer95_Config config = {
@@ -263,6 +447,9 @@ int main(int argc, char **argv) {
 		.sample_rate = DEFAULT_SAMPLE_RATE,
 		.offset = DEFAULT_OFFSET,
 		.test_mode = 0,
+		.gts = 1,
+		.clip_count = 0,
+		.cache_dir = DEFAULT_CACHE_DIR,
 		.ini_config_path = DEFAULT_CONFIG_PATH
 	};
 
@@ -306,8 +493,11 @@ int main(int argc, char **argv) {
 		return 1;
 	}
 
-	signal(SIGINT, stop);
-	signal(SIGTERM, stop);
+	// No SA_RESTART, the stop signal has to break the wait on the timer
+	struct sigaction sa = { .sa_handler = stop };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
 
 	int ret = run_chimer95(config, &runtime);
 	printf("Cleaning up...\n");
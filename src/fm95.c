@@ -1,9 +1,15 @@
+#define _GNU_SOURCE
 #include <getopt.h>
+#include <sched.h>
+#include <time.h>
 #include <liquid/liquid.h>
 #include "ini.h"
 #include <stdbool.h>
 
 #define DEFAULT_INI_PATH "/etc/fm95/fm95.conf"
+#define DEFAULT_SOCKET_PATH "/etc/fm95/ctl.socket"
+
+#define MAX_STATIONS 64
 
 #define buffer_maxlength 192000
 #define buffer_tlength_fragsize -1
@@ -13,24 +19,35 @@
 #include "stereo_encoder.h"
 #include "bs412.h"
 #include "gain_control.h"
-#include "bit_ring.h"
+#include "rds_ring.h"
+#include "rds_group.h"
+#include "spectrum.h"
+#include "bs412_log.h"
+#include "recorder.h"
+#include "telemetry.h"
+#include "fm_modulator.h"
+#include "sample_format.h"
+#ifdef FM95_FIXED_POINT
+#include "fixed_point.h"
+#endif
 
 #define BUFFER_SIZE 16000 // This defines how many samples to process at a time, because the loop here is this: get signal -> process signal -> output signal, and when we get signal we actually get BUFFER_SIZE of them
 
 #include "audio.h"
 #include "ipc.h"
-
-static volatile sig_atomic_t to_run = 1;
-static volatile sig_atomic_t to_reload = 0;
+#include "vban_input.h"
 
 typedef struct {
 	bool mpx_on;
+	bool sca_on;
+	bool vban_in;
 } FM95_Options;
 typedef struct {
 	float audio;
 	float headroom;
 	float pilot;
 	float rds;
+	float sca;
 	float drive;
 	float makeup;
 } FM95_Volumes;
@@ -52,6 +69,7 @@ typedef struct {
 	float audio_preamp;
 
 	uint32_t sample_rate;
+	int16_t cpu;
 
 	char ini_config_path[64];
 
@@ -69,10 +87,34 @@ typedef struct {
 	float bs412_knee;
 	float bs412_strenght;
 	float lpf_cutoff;
+
+	float sca_frequency;
+	float sca_deviation;
+	float sca_clipper;
+	float sca_audio_volume;
+
+	uint8_t vban_min_buffer;
+	uint8_t vban_max_buffer;
+
+	uint32_t spectrum_size; // FFT size of the MPX analyzer, 0 is off
+	uint32_t rds_ring_mode; // permissions of the shared RDS rings, 0 leaves them to the umask
+
+	char bs412_log_path[128]; // empty is off
+	uint32_t bs412_log_resolution;
+	uint32_t bs412_log_days;
+
+	char recorder_dir[128]; // empty is off
+	uint32_t recorder_segment;
+	uint32_t recorder_keep;
+	uint8_t recorder_input;
+
+	uint8_t output_format; // one of SAMPLE_*
+	uint8_t dither;
 } FM95_Config;
 
 typedef struct {
-	PulseInputDevice input_device, mpx_device;
+	PulseInputDevice input_device, mpx_device, sca_device;
+	VBANInput vban_input;
 	PulseOutputDevice output_device;
 	Oscillator osc;
 	iirfilt_rrrf lpf_l, lpf_r;
@@ -81,49 +123,91 @@ typedef struct {
 	StereoEncoder stencode;
 	AGC agc;
 	delay_line_t rds_delays[4];
-	bit_ring_t rds_bitring[4];
 	float rds_symbol[4];
 	uint8_t rds_last_bit[4];
+	uint32_t rds_prev_phase[4];
 	iirfilt_rrrf rds_filter[4];
+	FMModulator sca_mod;
+	uint8_t output_format; // what the output device was opened with
+	SampleDither dither;
+	bool dither_on;
+#ifdef FM95_FIXED_POINT
+	bool fixed; // false when something in the config has no fixed point version, the float kernels run then
+	BiquadCascade lpf_fix[2];
+	PreemphasisFix preemp_fix[2];
+	BiquadCascade rds_filter_fix[4];
+#endif
 } FM95_Runtime;
 
 typedef struct {
     char input[64];
     char output[64];
     char mpx[64];
+    char sca[64];
+    char socket[108];
 } FM95_DeviceNames;
 typedef struct {
     FM95_Config* config;
     FM95_DeviceNames* devices;
+    const char* station; // NULL parses only the sections shared by all stations
 } FM95_SetupContext;
+typedef struct {
+	char names[MAX_STATIONS][32];
+	uint8_t count;
+} FM95_StationList;
 
+// Reply to the 0xff command, the full block telemetry is in shared memory (see telemetry.h)
 typedef struct {
 	float mpx_power;
 	float bs412_gain;
 	float agc_gain;
-	float input_level;
-	float audio_level;
+	float input_level; // (|l| + |r|) / 2 of the block's last sample, not a peak
+	float audio_level; // signed (l + r) / 2 of the last clipped sample
 } FM95_RunResult;
 
+typedef struct {
+	char name[32]; // Empty when running a single station
+	FM95_Config config;
+	FM95_DeviceNames dv_names;
+	FM95_Runtime runtime;
+	Telemetry telemetry;
+	RdsRing rds_rings[4]; // outlive reloads, the encoders keep them mapped
+	SpectrumAnalyzer spectrum;
+	Bs412Logger bs412_log;
+	Recorder mpx_recorder;
+	Recorder input_recorder;
+	volatile sig_atomic_t to_run;
+	volatile sig_atomic_t to_reload;
+	pthread_t thread;
+	int ret;
+} FM95_Instance;
+
+static FM95_Instance* instances = NULL;
+static uint8_t instance_count = 0;
+
 static inline bool compare_dvs(const FM95_DeviceNames *a, const FM95_DeviceNames *b) {
-    return strcmp(a->input, b->input) == 0 && strcmp(a->output, b->output) == 0 && strcmp(a->mpx, b->mpx) == 0;
+    return strcmp(a->input, b->input) == 0 && strcmp(a->output, b->output) == 0 && strcmp(a->mpx, b->mpx) == 0 && strcmp(a->sca, b->sca) == 0 && strcmp(a->socket, b->socket) == 0;
 }
 
-static float calculate_sharedaudio_volume(const FM95_Volumes volumes, const int rds_streams) {
-	return 1.0f - (volumes.rds * rds_streams) - volumes.pilot - volumes.headroom;
+static float calculate_sharedaudio_volume(const FM95_Volumes volumes, const int rds_streams, const bool sca_on) {
+	return 1.0f - (volumes.rds * rds_streams) - volumes.pilot - volumes.headroom - (sca_on ? volumes.sca : 0.0f);
 }
 
 static void stop(int signum) {
 	(void)signum;
 	printf("\nReceived stop signal.\n");
-	to_run = 0;
-	to_reload = 0; // Make sure we don't reload
+	for(uint8_t i = 0; i < instance_count; i++) {
+		instances[i].to_run = 0;
+		instances[i].to_reload = 0; // Make sure we don't reload
+	}
 }
 static void reload(int signum) {
 	(void)signum;
 	printf("\nReceived reload signal.\n");
-	to_run = 0; // To run is a flag, just telling when to stop the loop
-	to_reload = 1;
+	for(uint8_t i = 0; i < instance_count; i++) {
+		instances[i].to_run = 0; // To run is a flag, just telling when to stop the loop
+		instances[i].to_reload = 1;
+	}
 }
 
 void show_help(char *name) {
@@ -143,32 +227,372 @@ void cleanup_runtime(FM95_Runtime* runtime, const FM95_Config config) {
 	} exit_stereo_encoder(&runtime->stencode);
 
 	for(int i = 0; i < 4; i++) {
-		free(runtime->rds_bitring[i].bits);
 		iirfilt_rrrf_destroy(runtime->rds_filter[i]);
 		if(config.stereo_ssb) exit_delay_line(&runtime->rds_delays[i]);
 	}
 }
 
+static void free_input(FM95_Runtime* runtime, const FM95_Options options) {
+	if(options.vban_in) exit_vban_input(&runtime->vban_input);
+	else free_PulseDevice(&runtime->input_device);
+}
+
 void cleanup_audio_runtime(FM95_Runtime *rt, const FM95_Options options) {
-    free_PulseDevice(&rt->input_device);
+    free_input(rt, options);
     if (options.mpx_on) free_PulseDevice(&rt->mpx_device);
+    if (options.sca_on) free_PulseDevice(&rt->sca_device);
     free_PulseDevice(&rt->output_device);
 }
 
+// Encodes the block into the output device's format, F32 goes out as it is
+static int write_output(FM95_Runtime* runtime, const float* output, uint8_t* scratch) {
+	if(runtime->output_format == SAMPLE_F32) return write_PulseOutputDevice(&runtime->output_device, (void*)output, BUFFER_SIZE * sizeof(float));
+	encode_samples(output, scratch, BUFFER_SIZE, runtime->output_format, runtime->dither_on ? &runtime->dither : NULL);
+	return write_PulseOutputDevice(&runtime->output_device, scratch, BUFFER_SIZE * sample_format_bytes[runtime->output_format]);
+}
+
 #define _pulse_output \
-if((pulse_error = write_PulseOutputDevice(&runtime->output_device, output, sizeof(output)))) { \
+if((pulse_error = write_output(runtime, output, output_bytes))) { \
 	fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error)); \
-	to_run = 0; \
+	inst->to_run = 0; \
 	break; \
 }
 
-int run_fm95(FM95_Config* config, FM95_Runtime* runtime, FM95_RunResult* result) {
+#ifdef FM95_FIXED_POINT
+static int write_output_fix(FM95_Runtime* runtime, const int32_t* q31, uint8_t* scratch) {
+	encode_q31_samples(q31, scratch, BUFFER_SIZE, runtime->output_format, runtime->dither_on ? &runtime->dither : NULL);
+	return write_PulseOutputDevice(&runtime->output_device, scratch, BUFFER_SIZE * sample_format_bytes[runtime->output_format]);
+}
+
+#define _pulse_output_fix \
+if((pulse_error = write_output_fix(runtime, output_q31, output_bytes))) { \
+	fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error)); \
+	inst->to_run = 0; \
+	break; \
+}
+#endif
+
+typedef struct {
+	float input_peak;
+	float audio_peak;
+	float output_peak;
+	float input_last; // of the last sample, for command 0xff
+	float audio_last;
+	float agc_gain;
+	float mpx_power;
+	double composite_power;
+} FM95_BlockStats;
+
+// Where in the 1187.5 Hz cycle each RDS stream starts its bits
+static const uint32_t rds_stream_shift[4] = {0, 2 * PHASE_QUARTER, PHASE_QUARTER, 3 * PHASE_QUARTER};
+
+#define FM95_KERNEL_ARGS FM95_Instance* inst, const FM95_Config* restrict cfg, const float* restrict input, const float* restrict extra, float* restrict output, FM95_BlockStats* stats
+typedef void (*fm95_kernel_fn)(FM95_KERNEL_ARGS);
+
+// One block of the whole chain. The feature flags are compile-time constants in every variant below, so the disabled stages are not in its code at all
+static inline __attribute__((always_inline)) void fm95_kernel(FM95_KERNEL_ARGS, const bool agc, const bool lpf, const bool preemp, const bool rds) {
+	FM95_Runtime* runtime = &inst->runtime;
+
+	const float preamp = cfg->audio_preamp;
+	const float drive = cfg->volumes.drive;
+	const float softclip_norm = cfg->volumes.makeup / tanhf(drive);
+	const float rds_volume = cfg->volumes.rds;
+	const float master_volume = cfg->master_volume;
+	const uint8_t rds_streams = cfg->rds_streams;
+	const uint8_t stereo = cfg->stereo;
+	const bool ssb = cfg->stereo_ssb != 0;
+
+	float input_peak = 0.0f, audio_peak = 0.0f, output_peak = 0.0f;
+	float input_last = 0.0f, audio_last = 0.0f;
+	float agc_gain = 0.0f, mpx_power = 0.0f;
+	double composite_power = 0.0;
+
+	for(uint16_t i = 0; i < BUFFER_SIZE; i++) {
+		advance_oscillator(&runtime->osc);
+
+		float audio = 0.0f;
+
+		float l = input[2*i+0]*preamp;
+		float r = input[2*i+1]*preamp;
+
+		float mono = 0.5f * (fabsf(l) + fabsf(r));
+		input_peak = fmaxf(input_peak, mono);
+		input_last = mono;
+
+		if(agc) {
+			agc_gain = process_agc(&runtime->agc, mono);
+			l *= agc_gain;
+			r *= agc_gain;
+		}
+
+		float mod_l = l, mod_r = r;
+
+		if(lpf) {
+			iirfilt_rrrf_execute(runtime->lpf_l, l, &mod_l);
+			iirfilt_rrrf_execute(runtime->lpf_r, r, &mod_r);
+		}
+
+		if(preemp) {
+			mod_l = apply_preemphasis(&runtime->preemp_l, mod_l);
+			mod_r = apply_preemphasis(&runtime->preemp_r, mod_r);
+		}
+
+		mod_l = tanhf(mod_l * drive) * softclip_norm;
+		mod_r = tanhf(mod_r * drive) * softclip_norm;
+
+		audio_peak = fmaxf(audio_peak, fmaxf(fabsf(mod_l), fabsf(mod_r)));
+		audio_last = (mod_l + mod_r) * 0.5f;
+
+		float mpx = stereo_encode(&runtime->stencode, stereo, mod_l, mod_r, &audio);
+
+		if(rds) {
+			float clock = get_oscillator_cos_multiplier_ni(&runtime->osc, 1);
+			for (uint8_t stream = 0; stream < rds_streams; stream++) {
+				if (oscillator_did_cycle(&runtime->osc, rds_stream_shift[stream], &runtime->rds_prev_phase[stream])) {
+					uint8_t bit;
+					if (rds_ring_next_bit(&inst->rds_rings[stream], &bit)) runtime->rds_last_bit[stream] = bit;
+					runtime->rds_symbol[stream] = runtime->rds_last_bit[stream] ? 1.0f : -1.0f;
+				}
+
+				uint8_t osc_stream = 12 + stream;
+				if (osc_stream >= 13) osc_stream++; // "The first position, 61,75 kHz is not used to protect the basic subcarrier of 57 kHz on existing receivers." - IEC 62106-1
+
+				float shaped;
+				iirfilt_rrrf_execute(runtime->rds_filter[stream], runtime->rds_symbol[stream], &shaped);
+
+				float carrier = get_oscillator_cos_multiplier_ni(&runtime->osc, osc_stream * 4);
+				if (ssb) carrier = delay_line(&runtime->rds_delays[stream], carrier);
+				mpx += clock * shaped * carrier * rds_volume;
+			}
+		}
+
+		mpx = bs412_compress(&runtime->bs412, audio, mpx+extra[i], &mpx_power);
+		output_peak = fmaxf(output_peak, fabsf(mpx));
+
+		float composite = tanhf(mpx);
+		composite_power += composite * composite;
+		output[i] = composite*master_volume; // Ensure peak deviation of 75 khz (or the set deviation), assuming we're calibrated correctly
+	}
+
+	stats->input_peak = input_peak;
+	stats->audio_peak = audio_peak;
+	stats->output_peak = output_peak;
+	stats->input_last = input_last;
+	stats->audio_last = audio_last;
+	stats->agc_gain = agc_gain;
+	stats->mpx_power = mpx_power;
+	stats->composite_power = composite_power;
+}
+
+// Every combination of agc, lpf, preemphasis and rds, in the order of the dispatch index
+#define FM95_KERNEL_VARIANTS(X) \
+	X(0,0,0,0) X(1,0,0,0) X(0,1,0,0) X(1,1,0,0) X(0,0,1,0) X(1,0,1,0) X(0,1,1,0) X(1,1,1,0) \
+	X(0,0,0,1) X(1,0,0,1) X(0,1,0,1) X(1,1,0,1) X(0,0,1,1) X(1,0,1,1) X(0,1,1,1) X(1,1,1,1)
+
+#define FM95_DEFINE_KERNEL(agc, lpf, preemp, rds) \
+	static void fm95_kernel_##agc##lpf##preemp##rds(FM95_KERNEL_ARGS) { fm95_kernel(inst, cfg, input, extra, output, stats, agc, lpf, preemp, rds); }
+#define FM95_KERNEL_ENTRY(agc, lpf, preemp, rds) fm95_kernel_##agc##lpf##preemp##rds,
+
+FM95_KERNEL_VARIANTS(FM95_DEFINE_KERNEL)
+static const fm95_kernel_fn fm95_kernels[16] = { FM95_KERNEL_VARIANTS(FM95_KERNEL_ENTRY) };
+
+static inline uint8_t kernel_index(const FM95_Config* cfg) {
+	return (cfg->agc_max != 0.0f) | ((cfg->lpf_cutoff != 0) << 1) | ((cfg->preemphasis != 0) << 2) | ((cfg->rds_streams != 0) << 3);
+}
+
+static inline fm95_kernel_fn select_kernel(const FM95_Config* cfg) {
+	return fm95_kernels[kernel_index(cfg)];
+}
+
+#ifdef FM95_FIXED_POINT
+#define FM95_FIX_KERNEL_ARGS FM95_Instance* inst, const FM95_Config* restrict cfg, const fix_t* restrict input, const fix_t* restrict extra, int32_t* restrict output, FM95_BlockStats* stats
+typedef void (*fm95_fix_kernel_fn)(FM95_FIX_KERNEL_ARGS);
+
+static inline fix_t fix_abs(fix_t x) { return (x < 0) ? -x : x; }
+
+// AGC and BS412 work out their gains once per this many samples, from integer power sums, and hold them in between
+#define FIX_CONTROL_SAMPLES 32
+#define FIX_POWER_SHIFT 8 // Q27 to Q19 before squaring, so a control block sums in 64 bits
+#define FIX_POWER_SCALE (1.0 / (double)(1ll << (2 * (FIX_SIGNAL_BITS - FIX_POWER_SHIFT))))
+#define FIX_GATE_SHIFT 16 // the gate compares the audio power with this much less precision, in 32 bits
+_Static_assert(BUFFER_SIZE % FIX_CONTROL_SAMPLES == 0, "the control blocks have to tile the block");
+
+// The same chain in integers for boards with slow floats. Input comes in with the preamp applied, output is Q31. The gain computers stay float but only run at the control rate
+static inline __attribute__((always_inline)) void fm95_kernel_fix(FM95_FIX_KERNEL_ARGS, const bool agc, const bool lpf, const bool preemp, const bool rds) {
+	FM95_Runtime* runtime = &inst->runtime;
+
+	const float drive = cfg->volumes.drive;
+	const int32_t drive_fix = coef_from_float(drive, FIX_DRIVE_BITS);
+	const int32_t softclip_norm = coef_from_float(cfg->volumes.makeup / tanhf(drive), FIX_DRIVE_BITS);
+	const int32_t master_volume = coef_from_float(cfg->master_volume, FIX_GAIN_BITS);
+	const q15_t audio_volume = q15_from_float(runtime->stencode.audio_volume);
+	const q15_t pilot_volume = q15_from_float(runtime->stencode.pilot_volume);
+	const q15_t rds_volume = q15_from_float(cfg->volumes.rds);
+	const uint8_t rds_streams = cfg->rds_streams;
+	const uint8_t stereo = cfg->stereo;
+
+	fix_t input_peak = 0, audio_peak = 0, output_peak = 0;
+	fix_t input_last = 0, audio_last = 0;
+	float agc_gain = 0.0f, mpx_power = 0.0f;
+	int64_t composite_power = 0;
+
+	int32_t agc_gain_fix = 0, bs412_gain_fix = 0;
+	bool bs412_on = false;
+	uint32_t gate = 0;
+	int64_t gate_recip = 0;
+	int64_t sidechain_power = 0, audio_power = 0, cross_power = 0, mpx_power_sum = 0, gate_weight = 0;
+
+	for(uint16_t i = 0; i < BUFFER_SIZE; i++) {
+		if(i % FIX_CONTROL_SAMPLES == 0) {
+			if(i != 0) {
+				if(agc) agc_gain = process_agc_block(&runtime->agc, (float)(sidechain_power * FIX_POWER_SCALE / FIX_CONTROL_SAMPLES), FIX_CONTROL_SAMPLES);
+				bs412_compress_block(&runtime->bs412, audio_power * FIX_POWER_SCALE, cross_power * FIX_POWER_SCALE, mpx_power_sum * FIX_POWER_SCALE, gate_weight / 65536.0, FIX_CONTROL_SAMPLES, &mpx_power);
+				sidechain_power = audio_power = cross_power = mpx_power_sum = gate_weight = 0;
+			}
+			if(agc) agc_gain_fix = coef_from_float(runtime->agc.currentGain, FIX_GAIN_BITS);
+			bs412_gain_fix = coef_from_float(runtime->bs412.gain, FIX_GAIN_BITS);
+			bs412_on = runtime->bs412.can_compress;
+
+			// BS412 gates on the gained audio power, move the threshold over to the audio before the gain instead
+			double g = runtime->bs412.gain;
+			double threshold = runtime->bs412.gate_threshold / (g * g) / FIX_POWER_SCALE / (1 << FIX_GATE_SHIFT);
+			gate = (uint32_t)fmin(fmax(threshold, 1.0), (double)(1 << 30));
+			gate_recip = (1ll << 48) / gate;
+		}
+
+		advance_oscillator(&runtime->osc);
+		const uint32_t phase = runtime->osc.phase;
+
+		fix_t l = input[2*i+0];
+		fix_t r = input[2*i+1];
+
+		fix_t mono = (fix_t)(((int64_t)fix_abs(l) + fix_abs(r)) >> 1);
+		if(mono > input_peak) input_peak = mono;
+		input_last = mono;
+
+		if(agc) {
+			fix_t m = mono >> FIX_POWER_SHIFT;
+			sidechain_power += (int64_t)m * m;
+			l = fix_mul(l, agc_gain_fix, FIX_GAIN_BITS);
+			r = fix_mul(r, agc_gain_fix, FIX_GAIN_BITS);
+		}
+
+		fix_t mod_l = l, mod_r = r;
+
+		if(lpf) {
+			mod_l = process_biquad_cascade(&runtime->lpf_fix[0], l);
+			mod_r = process_biquad_cascade(&runtime->lpf_fix[1], r);
+		}
+
+		if(preemp) {
+			mod_l = apply_preemphasis_fix(&runtime->preemp_fix[0], mod_l);
+			mod_r = apply_preemphasis_fix(&runtime->preemp_fix[1], mod_r);
+		}
+
+		// Q31 tanh times a Q24 gain, back to Q27
+		mod_l = fix_mul(softclip_q31(fix_mul(mod_l, drive_fix, FIX_DRIVE_BITS)), softclip_norm, 31 + FIX_DRIVE_BITS - FIX_SIGNAL_BITS);
+		mod_r = fix_mul(softclip_q31(fix_mul(mod_r, drive_fix, FIX_DRIVE_BITS)), softclip_norm, 31 + FIX_DRIVE_BITS - FIX_SIGNAL_BITS);
+
+		if(fix_abs(mod_l) > audio_peak) audio_peak = fix_abs(mod_l);
+		if(fix_abs(mod_r) > audio_peak) audio_peak = fix_abs(mod_r);
+
+		fix_t mid = (fix_t)(((int64_t)mod_l + mod_r) >> 1);
+		audio_last = mid;
+		fix_t audio, mpx = 0;
+		if(stereo) {
+			fix_t side = (fix_t)(((int64_t)mod_l - mod_r) >> 1);
+			audio = fix_mul_q15(sat_q31((int64_t)mid + fix_mul_q31(side, sine_lut_q31(phase * 32))), audio_volume);
+			mpx = fix_mul_q15(sine_lut_q31(phase * 16) >> (31 - FIX_SIGNAL_BITS), pilot_volume);
+		} else audio = sat_q31(((int64_t)mid * audio_volume) >> (FIX_MIX_BITS - 1));
+
+		if(rds) {
+			int32_t clock = sine_lut_q31(phase + PHASE_QUARTER);
+			for (uint8_t stream = 0; stream < rds_streams; stream++) {
+				if (oscillator_did_cycle(&runtime->osc, rds_stream_shift[stream], &runtime->rds_prev_phase[stream])) {
+					uint8_t bit;
+					if (rds_ring_next_bit(&inst->rds_rings[stream], &bit)) runtime->rds_last_bit[stream] = bit;
+				}
+
+				uint32_t osc_stream = 12 + stream;
+				if (osc_stream >= 13) osc_stream++; // See the float kernel
+
+				fix_t shaped = process_biquad_cascade(&runtime->rds_filter_fix[stream], runtime->rds_last_bit[stream] ? FIX_ONE : -FIX_ONE);
+				int32_t carrier = sine_lut_q31(phase * (osc_stream * 4) + PHASE_QUARTER);
+				mpx += fix_mul_q15(fix_mul_q31(fix_mul_q31(shaped, clock), carrier), rds_volume);
+			}
+		}
+
+		mpx = sat_q31((int64_t)mpx + extra[i]);
+		fix_t a = audio >> FIX_POWER_SHIFT, m = mpx >> FIX_POWER_SHIFT;
+		int64_t a2 = (int64_t)a * a;
+		uint32_t p = (uint32_t)(a2 >> FIX_GATE_SHIFT);
+		if(p >= 2 * gate) {
+			audio_power += a2;
+			cross_power += (int64_t)a * m;
+			mpx_power_sum += (int64_t)m * m;
+			gate_weight += 1 << 16;
+		} else if(p > gate) { // the gate opens linearly between one and two times the threshold, w is Q16
+			int64_t w = ((int64_t)(p - gate) * gate_recip) >> 32;
+			audio_power += (a2 * w) >> 16;
+			cross_power += ((int64_t)a * m * w) >> 16;
+			mpx_power_sum += ((int64_t)m * m * w) >> 16;
+			gate_weight += w;
+		}
+
+		fix_t total = sat_q31((int64_t)(bs412_on ? fix_mul(audio, bs412_gain_fix, FIX_GAIN_BITS) : audio) + mpx);
+		if(fix_abs(total) > output_peak) output_peak = fix_abs(total);
+
+		int32_t composite = softclip_q31(total);
+		int32_t c = composite >> 16;
+		composite_power += (int64_t)c * c;
+		output[i] = fix_mul(composite, master_volume, FIX_GAIN_BITS);
+	}
+
+	if(agc) agc_gain = process_agc_block(&runtime->agc, (float)(sidechain_power * FIX_POWER_SCALE / FIX_CONTROL_SAMPLES), FIX_CONTROL_SAMPLES);
+	bs412_compress_block(&runtime->bs412, audio_power * FIX_POWER_SCALE, cross_power * FIX_POWER_SCALE, mpx_power_sum * FIX_POWER_SCALE, gate_weight / 65536.0, FIX_CONTROL_SAMPLES, &mpx_power);
+
+	stats->input_peak = fix_to_float(input_peak);
+	stats->audio_peak = fix_to_float(audio_peak);
+	stats->output_peak = fix_to_float(output_peak);
+	stats->input_last = fix_to_float(input_last);
+	stats->audio_last = fix_to_float(audio_last);
+	stats->agc_gain = agc_gain;
+	stats->mpx_power = mpx_power;
+	stats->composite_power = (double)composite_power / (double)(1 << 30);
+}
+
+#define FM95_DEFINE_FIX_KERNEL(agc, lpf, preemp, rds) \
+	static void fm95_kernel_fix_##agc##lpf##preemp##rds(FM95_FIX_KERNEL_ARGS) { fm95_kernel_fix(inst, cfg, input, extra, output, stats, agc, lpf, preemp, rds); }
+#define FM95_FIX_KERNEL_ENTRY(agc, lpf, preemp, rds) fm95_kernel_fix_##agc##lpf##preemp##rds,
+
+FM95_KERNEL_VARIANTS(FM95_DEFINE_FIX_KERNEL)
+static const fm95_fix_kernel_fn fm95_fix_kernels[16] = { FM95_KERNEL_VARIANTS(FM95_FIX_KERNEL_ENTRY) };
+#endif
+
+int run_fm95(FM95_Instance* inst) {
+	FM95_Config* config = &inst->config;
+	FM95_Runtime* runtime = &inst->runtime;
+	TelemetryData telemetry = {
+		.sample_rate = config->sample_rate,
+		.block_size = BUFFER_SIZE,
+	};
+	if(inst->telemetry.page != NULL) { // counters carry on over reloads
+		telemetry.blocks = inst->telemetry.page->data.blocks;
+		telemetry.samples = inst->telemetry.page->data.samples;
+	}
+
 	float output[BUFFER_SIZE];
+	uint8_t output_bytes[BUFFER_SIZE * 4];
+#ifdef FM95_FIXED_POINT
+	int32_t output_q31[BUFFER_SIZE];
+	fix_t input_fix[BUFFER_SIZE*2];
+	fix_t extra_fix[BUFFER_SIZE];
+#endif
 
 	int pulse_error;
 
 	if(config->calibration != 0) {
-		while(to_run) {
+		while(inst->to_run) {
 			for (int i = 0; i < BUFFER_SIZE; i++) {
 				float sample = get_oscillator_sin_sample(&runtime->osc);
 				if(config->calibration == 2) sample = (sample > 0.0f) ? 1.0f : -1.0f; // Sine wave to square wave filter, 50% duty cycle
@@ -182,93 +606,95 @@ int run_fm95(FM95_Config* config, FM95_Runtime* runtime, FM95_RunResult* result)
 	float audio_stereo_input[BUFFER_SIZE*2]; // Stereo
 
 	float mpx_in[BUFFER_SIZE] = {0};
+	float sca_in[BUFFER_SIZE] = {0};
+	float sca_out[BUFFER_SIZE];
 
 	bool mpx_on = config->options.mpx_on;
+	bool sca_on = config->options.sca_on;
 
-	while (to_run) {
-		float softclip_norm = config->volumes.makeup / tanhf(config->volumes.drive);
+	float extra[BUFFER_SIZE]; // MPX passthrough and SCA, summed before the kernel
 
-		if((pulse_error = read_PulseInputDevice(&runtime->input_device, audio_stereo_input, sizeof(audio_stereo_input)))) { // get output from the function and assign it into pulse_error, this comment to avoid confusion
+	while (inst->to_run) {
+		// The IPC thread may change the config at any time, a block works from a copy of it
+		FM95_Config cfg = inst->config;
+
+		if(cfg.options.vban_in) read_vban_input(&runtime->vban_input, audio_stereo_input, BUFFER_SIZE);
+		else if((pulse_error = read_PulseInputDevice(&runtime->input_device, audio_stereo_input, sizeof(audio_stereo_input)))) { // get output from the function and assign it into pulse_error, this comment to avoid confusion
 			fprintf(stderr, "Error reading from input device: %s\n", pa_strerror(pulse_error));
-			to_run = 0;
+			inst->to_run = 0;
 			break;
 		}
+		if(inst->input_recorder.running) record_block(&inst->input_recorder, audio_stereo_input);
 		if(mpx_on) {
 			if((pulse_error = read_PulseInputDevice(&runtime->mpx_device, mpx_in, sizeof(mpx_in)))) {
 				fprintf(stderr, "Error reading from MPX device: %s\nDisabling MPX.\n", pa_strerror(pulse_error));
 				mpx_on = 0;
+				memset(mpx_in, 0, sizeof(mpx_in));
 			}
 		}
+		if(sca_on) {
+			if((pulse_error = read_PulseInputDevice(&runtime->sca_device, sca_in, sizeof(sca_in)))) {
+				fprintf(stderr, "Error reading from SCA device: %s\nDisabling SCA, the audio takes over its share of the level.\n", pa_strerror(pulse_error));
+				sca_on = 0;
+				set_stereo_audio_volume(&runtime->stencode, calculate_sharedaudio_volume(cfg.volumes, cfg.rds_streams, false));
+			} else modulate_fm_block(&runtime->sca_mod, sca_in, sca_out, BUFFER_SIZE, cfg.sca_audio_volume, cfg.sca_clipper, cfg.volumes.sca);
+		}
 
-		for(uint16_t i = 0; i < BUFFER_SIZE; i++) {
-			advance_oscillator(&runtime->osc);
-			
-			bool do_result = (i == BUFFER_SIZE - 1);
-
-			float mpx = 0.0f;
-			float audio = 0.0f;
-
-			float l = audio_stereo_input[2*i+0]*config->audio_preamp;
-			float r = audio_stereo_input[2*i+1]*config->audio_preamp;
-
-			float mono = 0.5f * (fabsf(l) + fabsf(r));
-			result->input_level = mono;
-
-			if(config->agc_max != 0.0) {
-				float agc_gain = process_agc(&runtime->agc, mono);
-				l *= agc_gain;
-				r *= agc_gain;
-				result->agc_gain = agc_gain;
-			} else result->agc_gain = 0.0f;
-
-			float mod_l, mod_r;
-
-			if(config->lpf_cutoff != 0) {
-				iirfilt_rrrf_execute(runtime->lpf_l, l, &mod_l);
-				iirfilt_rrrf_execute(runtime->lpf_r, r, &mod_r);
-			}
-	
-			if(config->preemphasis != 0) {
-				mod_l = apply_preemphasis(&runtime->preemp_l, mod_l);
-				mod_r = apply_preemphasis(&runtime->preemp_r, mod_r);
-			}
-
-			mod_l = tanhf(mod_l * config->volumes.drive) * softclip_norm;
-			mod_r = tanhf(mod_r * config->volumes.drive) * softclip_norm;
-
-			if(do_result) result->audio_level = (mod_l + mod_r) * 0.5f;
-
-			mpx = stereo_encode(&runtime->stencode, config->stereo, mod_l, mod_r, &audio);
-
-			{
-				static const float stream_shift[4] = {0.0f, (float)M_PI, (float)M_PI_2, (float)(3.0 * M_PI_2)};
-				static float prev_shifted_phase[4] = {0.0f, (float)M_PI, (float)M_PI_2, (float)(3.0 * M_PI_2)};
-
-				float clock = get_oscillator_cos_multiplier_ni(&runtime->osc, 1.0f);
-				for (uint8_t stream = 0; stream < config->rds_streams; stream++) {
-					if (oscillator_did_cycle(&runtime->osc, stream_shift[stream], &prev_shifted_phase[stream])) {
-						uint8_t bit;
-						if (bit_ring_read1(&runtime->rds_bitring[stream], &bit)) runtime->rds_last_bit[stream] = bit;
-						runtime->rds_symbol[stream] = runtime->rds_last_bit[stream] ? 1.0f : -1.0f;
-					}
-
-					uint8_t osc_stream = 12 + stream;
-					if (osc_stream >= 13) osc_stream++; // "The first position, 61,75 kHz is not used to protect the basic subcarrier of 57 kHz on existing receivers." - IEC 62106-1
-
-					float shaped;
-					iirfilt_rrrf_execute(runtime->rds_filter[stream], runtime->rds_symbol[stream], &shaped);
-
-					float carrier = get_oscillator_cos_multiplier_ni(&runtime->osc, osc_stream * 4.0f);
-					if (config->stereo_ssb) carrier = delay_line(&runtime->rds_delays[stream], carrier);
-					mpx += clock * shaped * carrier * config->volumes.rds;
-				}
-			}
+		const float* mix = mpx_in;
+		if(sca_on) {
+			for(uint16_t i = 0; i < BUFFER_SIZE; i++) extra[i] = mpx_in[i] + sca_out[i];
+			mix = extra;
+		}
 
-			mpx = bs412_compress(&runtime->bs412, audio, mpx+mpx_in[i], &result->mpx_power);
-			result->bs412_gain = runtime->bs412.gain;
+		FM95_BlockStats stats;
+#ifdef FM95_FIXED_POINT
+		bool taps = inst->spectrum.running || inst->mpx_recorder.running;
+		if(runtime->fixed) {
+			float_to_fix_block(audio_stereo_input, input_fix, BUFFER_SIZE*2, cfg.audio_preamp);
+			float_to_fix_block(mix, extra_fix, BUFFER_SIZE, 1.0f);
+			fm95_fix_kernels[kernel_index(&cfg)](inst, &cfg, input_fix, extra_fix, output_q31, &stats);
+			if(taps) q31_to_float_block(output_q31, output, BUFFER_SIZE);
+		} else select_kernel(&cfg)(inst, &cfg, audio_stereo_input, mix, output, &stats);
+#else
+		select_kernel(&cfg)(inst, &cfg, audio_stereo_input, mix, output, &stats);
+#endif
+
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		telemetry.blocks++;
+		telemetry.samples += BUFFER_SIZE;
+		telemetry.time_ns = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+		telemetry.mpx_power = stats.mpx_power;
+		telemetry.bs412_gain = runtime->bs412.gain;
+		telemetry.agc_gain = stats.agc_gain;
+		telemetry.input_level = stats.input_peak;
+		telemetry.audio_level = stats.audio_peak;
+		telemetry.output_level = stats.output_peak;
+		telemetry.input_sample = stats.input_last;
+		telemetry.audio_sample = stats.audio_last;
+		telemetry.stereo = cfg.stereo;
+		telemetry.rds_streams = cfg.rds_streams;
+		publish_telemetry(&inst->telemetry, &telemetry);
+		if(inst->spectrum.running) tap_block(&inst->spectrum.tap, output);
+		if(inst->mpx_recorder.running) record_block(&inst->mpx_recorder, output);
+		if(inst->bs412_log.running) {
+			Bs412LogBlock block = {
+				.power_sum = stats.composite_power / runtime->bs412.reference,
+				.samples = BUFFER_SIZE,
+				.gain = runtime->bs412.gain,
+			};
+			log_bs412_block(&inst->bs412_log, &block);
+		}
 
-			output[i] = tanhf(mpx)*config->master_volume; // Ensure peak deviation of 75 khz (or the set deviation), assuming we're calibrated correctly
-		} _pulse_output;
+#ifdef FM95_FIXED_POINT
+		if(runtime->fixed) {
+			_pulse_output_fix;
+		} else {
+			_pulse_output;
+		}
+#else
+		_pulse_output;
+#endif
 	}
 
 	return 0;
@@ -302,6 +728,17 @@ static int config_handler(void* user, const char* section, const char* name, con
     FM95_Config* pconfig = ctx->config;
     FM95_DeviceNames* dv = ctx->devices;
 
+    // Station sections are written as [station/section], everything else is shared
+    const char* slash = strchr(section, '/');
+    if(ctx->station == NULL) {
+        if(slash != NULL) return 1;
+    } else {
+        if(slash == NULL) return 1;
+        size_t len = (size_t)(slash - section);
+        if(strlen(ctx->station) != len || strncmp(section, ctx->station, len) != 0) return 1;
+        section = slash + 1;
+    }
+
     #define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
 
     if (MATCH("fm95", "stereo")) pconfig->stereo = atoi(value);
@@ -314,6 +751,12 @@ static int config_handler(void* user, const char* section, const char* name, con
     } else if (MATCH("devices", "mpx")) {
         strncpy(dv->mpx, value, 63);
         dv->mpx[63] = '\0';
+    } else if (MATCH("devices", "sca")) {
+        strncpy(dv->sca, value, 63);
+        dv->sca[63] = '\0';
+    } else if (MATCH("devices", "socket")) {
+        strncpy(dv->socket, value, sizeof(dv->socket) - 1);
+        dv->socket[sizeof(dv->socket) - 1] = '\0';
 	} else if (MATCH("fm95", "preemphasis")) pconfig->preemphasis = atoi(value);
     else if (MATCH("fm95", "calibration")) pconfig->calibration = atoi(value);
     else if (MATCH("fm95", "mpx_power")) pconfig->mpx_power = strtof(value, NULL);
@@ -336,6 +779,28 @@ static int config_handler(void* user, const char* section, const char* name, con
 	else if(MATCH("advanced", "stereo_ssb")) pconfig->stereo_ssb = atoi(value);
 	else if(MATCH("advanced", "preemp_unity")) pconfig->preemp_unity_freq = strtof(value, NULL);
 	else if(MATCH("advanced", "sample_rate")) pconfig->sample_rate = atoi(value);
+	else if(MATCH("advanced", "cpu")) pconfig->cpu = atoi(value);
+	else if(MATCH("advanced", "spectrum")) pconfig->spectrum_size = atoi(value);
+	else if(MATCH("advanced", "rds_ring_mode")) pconfig->rds_ring_mode = strtoul(value, NULL, 8);
+	else if(MATCH("advanced", "output_format")) {
+		int format = parse_sample_format(value);
+		if(format < 0) {
+			fprintf(stderr, "Unknown output format: %s\n", value);
+			return 0;
+		}
+		pconfig->output_format = format;
+	} else if(MATCH("advanced", "dither")) pconfig->dither = atoi(value);
+	else if(MATCH("bs412_log", "file")) {
+		strncpy(pconfig->bs412_log_path, value, sizeof(pconfig->bs412_log_path) - 1);
+		pconfig->bs412_log_path[sizeof(pconfig->bs412_log_path) - 1] = '\0';
+	} else if(MATCH("bs412_log", "resolution")) pconfig->bs412_log_resolution = atoi(value);
+	else if(MATCH("bs412_log", "days")) pconfig->bs412_log_days = atoi(value);
+	else if(MATCH("recorder", "dir")) {
+		strncpy(pconfig->recorder_dir, value, sizeof(pconfig->recorder_dir) - 1);
+		pconfig->recorder_dir[sizeof(pconfig->recorder_dir) - 1] = '\0';
+	} else if(MATCH("recorder", "segment")) pconfig->recorder_segment = atoi(value);
+	else if(MATCH("recorder", "keep")) pconfig->recorder_keep = atoi(value);
+	else if(MATCH("recorder", "input")) pconfig->recorder_input = atoi(value);
 	else if(MATCH("advanced", "lpf_cutoff")) {
 		pconfig->lpf_cutoff = strtof(value, NULL);
 		if(pconfig->lpf_cutoff > (pconfig->sample_rate * 0.5)) {
@@ -348,18 +813,56 @@ static int config_handler(void* user, const char* section, const char* name, con
 	else if(MATCH("advanced", "makeup")) pconfig->volumes.makeup = strtof(value, NULL);
 	else if(MATCH("volumes", "pilot")) pconfig->volumes.pilot = strtof(value, NULL);
 	else if(MATCH("volumes", "rds")) pconfig->volumes.rds = strtof(value, NULL);
+	else if(MATCH("sca", "frequency")) pconfig->sca_frequency = strtof(value, NULL);
+	else if(MATCH("sca", "deviation")) pconfig->sca_deviation = strtof(value, NULL);
+	else if(MATCH("sca", "clipper")) pconfig->sca_clipper = strtof(value, NULL);
+	else if(MATCH("sca", "volume")) pconfig->volumes.sca = strtof(value, NULL);
+	else if(MATCH("sca", "audio_volume")) pconfig->sca_audio_volume = strtof(value, NULL);
+	else if(MATCH("vban", "min_buffer")) pconfig->vban_min_buffer = atoi(value);
+	else if(MATCH("vban", "max_buffer")) pconfig->vban_max_buffer = atoi(value);
 
     return 1;
 }
 
-int parse_config(FM95_Config* config, FM95_DeviceNames* dv) {
+int parse_config(FM95_Config* config, FM95_DeviceNames* dv, const char* station) {
 	FM95_SetupContext ctx = {
 		.config = config,
-		.devices = dv
+		.devices = dv,
+		.station = NULL
 	};
+	int err = ini_parse(config->ini_config_path, &config_handler, &ctx);
+	if(err != 0 || station == NULL || station[0] == 0) return err;
+
+	ctx.station = station; // The station's own sections override the shared ones
 	return ini_parse(config->ini_config_path, &config_handler, &ctx);
 }
 
+static int station_handler(void* user, const char* section, const char* name, const char* value) {
+	(void)name;
+	(void)value;
+	FM95_StationList* list = (FM95_StationList*)user;
+
+	const char* slash = strchr(section, '/');
+	if(slash == NULL) return 1;
+	size_t len = (size_t)(slash - section);
+	if(len == 0 || len >= sizeof(list->names[0])) return 0;
+
+	for(uint8_t i = 0; i < list->count; i++) {
+		if(strlen(list->names[i]) == len && strncmp(list->names[i], section, len) == 0) return 1;
+	}
+	if(list->count >= MAX_STATIONS) return 0;
+
+	memcpy(list->names[list->count], section, len);
+	list->names[list->count][len] = '\0';
+	list->count++;
+	return 1;
+}
+
+int find_stations(const char* path, FM95_StationList* list) {
+	memset(list, 0, sizeof(FM95_StationList));
+	return ini_parse(path, &station_handler, list);
+}
+
 int setup_audio(FM95_Runtime* runtime, const FM95_DeviceNames dv_names, const FM95_Config config) {
 	pa_buffer_attr input_buffer_atr = {
 		.maxlength = buffer_maxlength,
@@ -374,10 +877,18 @@ int setup_audio(FM95_Runtime* runtime, const FM95_DeviceNames dv_names, const FM
 	int opentime_pulse_error;
 
 	printf("Connecting to input device... (%s)\n", dv_names.input);
-	opentime_pulse_error = init_PulseInputDevice(&runtime->input_device, config.sample_rate, 2, "fm95", "Main Audio Input", dv_names.input, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
-	if (opentime_pulse_error) {
-		fprintf(stderr, "Error: cannot open input device: %s\n", pa_strerror(opentime_pulse_error));
-		return 1;
+	if(config.options.vban_in) {
+		// Straight off the network into the DSP loop, it drains the jitter buffer a block at a time
+		if(init_vban_input(&runtime->vban_input, dv_names.input, config.sample_rate, 2, config.vban_min_buffer, config.vban_max_buffer) != 0) {
+			fprintf(stderr, "Error: cannot open VBAN input\n");
+			return 1;
+		}
+	} else {
+		opentime_pulse_error = init_PulseInputDevice(&runtime->input_device, config.sample_rate, 2, "fm95", "Main Audio Input", dv_names.input, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
+		if (opentime_pulse_error) {
+			fprintf(stderr, "Error: cannot open input device: %s\n", pa_strerror(opentime_pulse_error));
+			return 1;
+		}
 	}
 
 	if(config.options.mpx_on) {
@@ -386,23 +897,71 @@ int setup_audio(FM95_Runtime* runtime, const FM95_DeviceNames dv_names, const FM
 		opentime_pulse_error = init_PulseInputDevice(&runtime->mpx_device, config.sample_rate, 1, "fm95", "MPX Input", dv_names.mpx, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
 		if (opentime_pulse_error) {
 			fprintf(stderr, "Error: cannot open MPX device: %s\n", pa_strerror(opentime_pulse_error));
-			free_PulseDevice(&runtime->input_device);
+			free_input(runtime, config.options);
+			return 1;
+		}
+	}
+
+	if(config.options.sca_on) {
+		printf("Connecting to SCA device... (%s)\n", dv_names.sca);
+
+		opentime_pulse_error = init_PulseInputDevice(&runtime->sca_device, config.sample_rate, 1, "fm95", "SCA Input", dv_names.sca, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
+		if (opentime_pulse_error) {
+			fprintf(stderr, "Error: cannot open SCA device: %s\n", pa_strerror(opentime_pulse_error));
+			free_input(runtime, config.options);
+			if(config.options.mpx_on) free_PulseDevice(&runtime->mpx_device);
 			return 1;
 		}
 	}
 
 	printf("Connecting to output device... (%s)\n", dv_names.output);
 
-	opentime_pulse_error = init_PulseOutputDevice(&runtime->output_device, config.sample_rate, 1, "fm95", "MPX Output", dv_names.output, &output_buffer_atr, PA_SAMPLE_FLOAT32NE);
+	runtime->output_format = config.output_format;
+	runtime->dither_on = config.dither != 0;
+	init_sample_dither(&runtime->dither, (uint32_t)time(NULL));
+	opentime_pulse_error = init_PulseOutputDevice(&runtime->output_device, config.sample_rate, 1, "fm95", "MPX Output", dv_names.output, &output_buffer_atr, pulse_sample_format(config.output_format));
 	if (opentime_pulse_error) {
 		fprintf(stderr, "Error: cannot open output device: %s\n", pa_strerror(opentime_pulse_error));
-		free_PulseDevice(&runtime->input_device);
+		free_input(runtime, config.options);
 		if(config.options.mpx_on) free_PulseDevice(&runtime->mpx_device);
+		if(config.options.sca_on) free_PulseDevice(&runtime->sca_device);
 		return 1;
 	}
 	return 0;
 }
 
+#ifdef FM95_FIXED_POINT
+// Designs the same filters as liquid does for the float chain and loads them as Q30 biquads
+static int init_biquad_prototype(BiquadCascade* bq, liquid_iirdes_filtertype type, unsigned int order, float fc, float as) {
+	unsigned int sections = (order + 1) / 2;
+	if(sections > BIQUAD_MAX_SECTIONS) return -1;
+	float b[3 * BIQUAD_MAX_SECTIONS], a[3 * BIQUAD_MAX_SECTIONS];
+	liquid_iirdes(type, LIQUID_IIRDES_LOWPASS, LIQUID_IIRDES_SOS, order, fc, 0.0f, 1.0f, as, b, a);
+	return init_biquad_cascade(bq, b, a, sections);
+}
+
+static void init_fixed_runtime(FM95_Runtime* runtime, const FM95_Config config) {
+	init_softclip_table();
+
+	runtime->fixed = (config.stereo_ssb == 0);
+
+	if(config.lpf_cutoff != 0) {
+		for(int i = 0; i < 2; i++) {
+			if(init_biquad_prototype(&runtime->lpf_fix[i], LIQUID_IIRDES_CHEBY2, config.lpf_order, config.lpf_cutoff/config.sample_rate, 40.0f) != 0) runtime->fixed = false;
+		}
+	}
+	if(config.preemphasis != 0) {
+		init_preemphasis_fix(&runtime->preemp_fix[0], runtime->preemp_l.alpha, runtime->preemp_l.gain);
+		init_preemphasis_fix(&runtime->preemp_fix[1], runtime->preemp_r.alpha, runtime->preemp_r.gain);
+	}
+	for(int i = 0; i < 4; i++) {
+		if(init_biquad_prototype(&runtime->rds_filter_fix[i], LIQUID_IIRDES_BUTTER, 5, 2400.0f/config.sample_rate, 30.0f) != 0) runtime->fixed = false;
+	}
+
+	if(!runtime->fixed) fprintf(stderr, "This configuration has no fixed point version, running the float chain.\n");
+}
+#endif
+
 void init_runtime(FM95_Runtime* runtime, const FM95_Config config) {
 	if(config.calibration != 0) {
 		init_oscillator(&runtime->osc, (config.calibration == 2) ? 60 : ((config.calibration == 1) ? 400 : 19000), config.sample_rate);
@@ -423,7 +982,7 @@ void init_runtime(FM95_Runtime* runtime, const FM95_Config config) {
 	if(runtime->bs412.init == true && (runtime->bs412.sample_rate == config.sample_rate)) {
 		reinit_bs412(&runtime->bs412, config.mpx_deviation, config.mpx_power, config.bs412_attack, config.bs412_release, config.bs412_max, config.bs412_gate, config.bs412_knee, config.bs412_strenght);
 	} else init_bs412(&runtime->bs412, config.mpx_deviation, config.mpx_power, config.bs412_attack, config.bs412_release, config.bs412_max, config.bs412_gate, config.bs412_knee, config.bs412_strenght, config.sample_rate);
-	init_stereo_encoder(&runtime->stencode, config.stereo_ssb, 16.0f, &runtime->osc, config.volumes.audio, config.volumes.pilot);
+	init_stereo_encoder(&runtime->stencode, config.stereo_ssb, 16, &runtime->osc, config.volumes.audio, config.volumes.pilot);
 
 	float last_gain = 0.0f;
 	if(config.agc_max != 0.0) {
@@ -434,7 +993,6 @@ void init_runtime(FM95_Runtime* runtime, const FM95_Config config) {
 	}
 
 	for(int i = 0; i < 4; i++) {
-		bit_ring_init(&runtime->rds_bitring[i], 4096);
 		runtime->rds_symbol[i] = -1.0f;
 		runtime->rds_last_bit[i] = 0;
 
@@ -442,179 +1000,198 @@ void init_runtime(FM95_Runtime* runtime, const FM95_Config config) {
 
 		if(config.stereo_ssb) init_delay_line(&runtime->rds_delays[i], config.stereo_ssb*2);
 	}
+
+	if(config.options.sca_on) init_fm_modulator(&runtime->sca_mod, config.sca_frequency, config.sca_deviation, config.sample_rate);
+
+#ifdef FM95_FIXED_POINT
+	init_fixed_runtime(runtime, config);
+#endif
 }
 
-#define BUF_SIZE 256
+// Runs one framed command, the IPC thread batches the replies of everything a client sent together
+static void handle_command(const uint8_t *buf, size_t n, ipc_buffer_t *out, void *user_data) {
+	FM95_Instance* inst = user_data;
+	uint8_t reply = 0xff;
+	float val = 0.0f;
+	uint8_t bval = 0;
+
+	if(buf[0] >= 101 && buf[0] <= 111) {
+		if(n < 1 + sizeof(float)) {
+			reply = 1;
+			ipc_reply(out, &reply, 1);
+			return;
+		}
+		memcpy(&val, buf + 1, sizeof(float));
+	}
 
-typedef struct {
-	FM95_Runtime* runtime;
-	FM95_Config* config;
-	FM95_RunResult* run_result;
-} FM95_Data;
-
-static void *handle_client(ipc_client_arg_t *arg) {
-    int fd = arg->client_fd;
-	FM95_Data* data = arg->user_data;
-    free(arg);
-
-    uint8_t buf[BUF_SIZE];
-	uint8_t reply = 0;
-    ssize_t n;
-	float val;
-	uint8_t bval;
-
-    while ((n = recv(fd, buf, sizeof(buf) - 1, 0)) > 0) {
-		reply = 0xff;
-        buf[n] = '\0';
-		switch (buf[0]) {
-			case 1:
-				// Reload
-				to_run = 0;
-				to_reload = 1;
-				reply = 0;
-				break;
-			case 2:
-				// Quit
-				to_run = 0;
-				to_reload = 0;
-				reply = 0;
-				break;
-			case 100:
-				// Toggle stereo
-				data->config->stereo ^= 1;
-				reply = data->config->stereo;
-				break;
-			case 101:
-				// Set makeup
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->volumes.makeup = val;
-				reply = 0;
-				break;
-			case 102:
-				// Set drive
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->volumes.drive = val;
-				reply = 0;
-				break;
-			case 103:
-				// Set audio preamp
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->audio_preamp = val;
-				reply = 0;
-				break;
-			case 104:
-				// Set master volume
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->master_volume = val;
-				reply = 0;
-				break;
-			case 105:
-				// Set BS412 gate
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->bs412_gate = val;
-				reply = 0;
-				to_run = 0;
-				to_reload = 1;
-				break;
-			case 106:
-				// Set BS412 mpx power
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->mpx_power = val;
-				reply = 0;
-				to_run = 0;
-				to_reload = 1;
-				break;
-			case 107:
-				// Set BS412 attack
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->bs412_attack = val;
-				reply = 0;
-				to_run = 0;
-				to_reload = 1;
-				break;
-			case 108:
-				// Set BS412 release
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->bs412_release = val;
-				reply = 0;
-				to_run = 0;
-				to_reload = 1;
-				break;
-			case 109:
-				// Set BS412 max
-				memcpy(&val, buf + 1, sizeof(float));
-				data->config->bs412_max = val;
-				reply = 0;
-				to_run = 0;
-				to_reload = 1;
-				break;
-			case 110:
-				// Set BS412 knee
-				memcpy(&val, buf + 1, sizeof(float));
-				data->runtime->bs412.knee_db = val;
-				reply = 0;
-				break;
-			case 111:
-				// Set BS412 strenght
-				memcpy(&val, buf + 1, sizeof(float));
-				data->runtime->bs412.strenght = val;
-				reply = 0;
-				break;
-			case 112: {
-				if (n < 2) { reply = 1; break; }
-				uint8_t stream = buf[1];
-				if(stream > 3) stream = 3;
-
-				uint8_t unpacked[8 * (BUF_SIZE - 2)];
-				size_t nbits = 0;
-				for (ssize_t i = 2; i < n; i++) {
-					for (int b = 7; b >= 0; b--)
-						unpacked[nbits++] = (buf[i] >> b) & 1;
-				}
-				size_t written = bit_ring_write(&data->runtime->rds_bitring[stream], unpacked, nbits);
-				if (written < nbits) {
-					fprintf(stderr, "rds bitring overrun: dropped %zu of %zu bits\n", nbits - written, nbits);
-				}
-				reply = (written < nbits) ? 2 : 0;
-				break;
+	switch (buf[0]) {
+		case 1:
+			// Reload
+			inst->to_run = 0;
+			inst->to_reload = 1;
+			reply = 0;
+			break;
+		case 2:
+			// Quit
+			inst->to_run = 0;
+			inst->to_reload = 0;
+			reply = 0;
+			break;
+		case 100:
+			// Toggle stereo
+			inst->config.stereo ^= 1;
+			reply = inst->config.stereo;
+			break;
+		case 101:
+			// Set makeup
+			inst->config.volumes.makeup = val;
+			reply = 0;
+			break;
+		case 102:
+			// Set drive
+			inst->config.volumes.drive = val;
+			reply = 0;
+			break;
+		case 103:
+			// Set audio preamp
+			inst->config.audio_preamp = val;
+			reply = 0;
+			break;
+		case 104:
+			// Set master volume
+			inst->config.master_volume = val;
+			reply = 0;
+			break;
+		case 105:
+			// Set BS412 gate
+			inst->config.bs412_gate = val;
+			reply = 0;
+			inst->to_run = 0;
+			inst->to_reload = 1;
+			break;
+		case 106:
+			// Set BS412 mpx power
+			inst->config.mpx_power = val;
+			reply = 0;
+			inst->to_run = 0;
+			inst->to_reload = 1;
+			break;
+		case 107:
+			// Set BS412 attack
+			inst->config.bs412_attack = val;
+			reply = 0;
+			inst->to_run = 0;
+			inst->to_reload = 1;
+			break;
+		case 108:
+			// Set BS412 release
+			inst->config.bs412_release = val;
+			reply = 0;
+			inst->to_run = 0;
+			inst->to_reload = 1;
+			break;
+		case 109:
+			// Set BS412 max
+			inst->config.bs412_max = val;
+			reply = 0;
+			inst->to_run = 0;
+			inst->to_reload = 1;
+			break;
+		case 110:
+			// Set BS412 knee
+			inst->runtime.bs412.knee_db = val;
+			reply = 0;
+			break;
+		case 111:
+			// Set BS412 strenght
+			inst->runtime.bs412.strenght = val;
+			reply = 0;
+			break;
+		case 112: {
+			if (n < 2) { reply = 1; break; }
+			uint8_t stream = buf[1];
+			if(stream > 3) stream = 3;
+
+			// A stream fed through shared memory refuses the socket, and the other way around
+			RdsRingShared* ring = rds_ring_socket(&inst->rds_rings[stream]);
+			if (ring == NULL) { reply = 1; break; }
+			size_t nbytes = n - 2;
+			size_t written = rds_ring_write(ring, buf + 2, nbytes);
+			if (written < nbytes) {
+				fprintf(stderr, "rds ring overrun: dropped %zu of %zu bytes\n", nbytes - written, nbytes);
 			}
-			case 113:
-				// Set RDS streams
-				memcpy(&bval, buf + 1, 1);
-				if(data->config->rds_streams != bval) {
-					data->config->rds_streams = bval;
-					data->config->volumes.audio = calculate_sharedaudio_volume(data->config->volumes, bval);
-				}
-				reply = 0;
-				break;
-			case 0xfe:
-				// Fetch config
-        		send(fd, data->config, sizeof(FM95_Config), 0);
-				break;
-			case 0xff:
-				// Fetch data
-        		send(fd, data->run_result, sizeof(FM95_RunResult), 0);
-				break;
-			default:
-				reply = 1; // Unknown command
-				break;
+			reply = (written < nbytes) ? 2 : 0;
+			break;
 		}
+		case 113:
+			// Set RDS streams
+			if (n < 2) { reply = 1; break; }
+			bval = buf[1];
+			if(inst->config.rds_streams != bval) {
+				inst->config.rds_streams = bval;
+				inst->config.volumes.audio = calculate_sharedaudio_volume(inst->config.volumes, bval, inst->config.options.sca_on);
+			}
+			reply = 0;
+			break;
+		case 114: {
+			// RDS groups, 4 big-endian information words each, the checkwords are ours to add
+			if (n < 2 || (n - 2) % 8 != 0) { reply = 1; break; }
+			uint8_t stream = buf[1];
+			if(stream > 3) stream = 3;
+			RdsRingShared* ring = rds_ring_socket(&inst->rds_rings[stream]);
+			if (ring == NULL) { reply = 1; break; }
+
+			size_t groups = (n - 2) / 8;
+			size_t fit = rds_ring_space(ring) / RDS_GROUP_BYTES; // whole groups only, a cut one would desync the decoder
+			size_t todo = groups < fit ? groups : fit;
+			const uint8_t* in = buf + 2;
+			uint16_t blocks[32 * RDS_GROUP_BLOCKS];
+			uint8_t packed[32 * RDS_GROUP_BYTES];
+			for (size_t done = 0; done < todo; done += 32) {
+				size_t chunk = (todo - done < 32) ? todo - done : 32;
+				for (size_t i = 0; i < chunk * RDS_GROUP_BLOCKS; i++, in += 2) blocks[i] = (in[0] << 8) | in[1];
+				encode_rds_groups(blocks, chunk, packed);
+				rds_ring_write(ring, packed, chunk * RDS_GROUP_BYTES);
+			}
+			if (todo < groups) {
+				fprintf(stderr, "rds ring overrun: dropped %zu of %zu groups\n", groups - todo, groups);
+			}
+			reply = (todo < groups) ? 2 : 0;
+			break;
+		}
+		case 0xfe:
+			// Fetch config
+			ipc_reply(out, &inst->config, sizeof(FM95_Config));
+			break;
+		case 0xff:
+			// Fetch data
+			{
+				TelemetryData data = {0};
+				if(inst->telemetry.page != NULL) read_telemetry(inst->telemetry.page, &data);
+				FM95_RunResult result = {
+					.mpx_power = data.mpx_power,
+					.bs412_gain = data.bs412_gain,
+					.agc_gain = data.agc_gain,
+					.input_level = data.input_sample,
+					.audio_level = data.audio_sample,
+				};
+				ipc_reply(out, &result, sizeof(FM95_RunResult));
+			}
+			break;
+		default:
+			reply = 1; // Unknown command
+			break;
+	}
 
-        if(reply != 0xff) send(fd, &reply, 1, 0);
-    }
-
-    printf("[client fd=%d] disconnected\n", fd);
-    close(fd);
-    return NULL;
+	if(reply != 0xff) ipc_reply(out, &reply, 1);
 }
 
-int main(int argc, char **argv) {
-	printf("fm95 (an FM Processor by radio95)\n");
-
-	FM95_Config config = {
+static void init_config(FM95_Config* config) {
+	*config = (FM95_Config){
 		.volumes = {
 			.pilot = 0.09f,
 			.rds = 0.045f,
+			.sca = 0.1f,
 			.headroom = 0.05f,
 			.drive = 1.0f,
 			.makeup = 1.0f
@@ -633,6 +1210,7 @@ int main(int argc, char **argv) {
 		.audio_preamp = 1.0f, // Volume of the audio before the filters
 
 		.sample_rate = 192000, // Sample rate for this whole gizmo to run on
+		.cpu = -1, // Don't pin
 
 		.ini_config_path = DEFAULT_INI_PATH,
 
@@ -650,93 +1228,223 @@ int main(int argc, char **argv) {
 		.bs412_knee = 4.0f,
 		.bs412_strenght = 1.0f,
 		.lpf_cutoff = 15000.0f,
-	};
 
-	FM95_DeviceNames dv_names = {
-		.input = "\0",
-		.output = "\0",
-		.mpx = "\0",
+		.sca_frequency = 67000.0f,
+		.sca_deviation = 7000.0f,
+		.sca_clipper = 1.0f,
+		.sca_audio_volume = 1.0f,
+
+		.vban_min_buffer = 24,
+		.vban_max_buffer = 96,
+
+		.bs412_log_resolution = 10,
+		.bs412_log_days = 90,
+
+		.recorder_segment = 300,
+		.recorder_keep = 24,
+
+#ifdef FM95_FIXED_POINT
+		.output_format = SAMPLE_S32,
+#else
+		.output_format = SAMPLE_F32,
+#endif
+		.dither = 1,
 	};
-	FM95_DeviceNames old_dv_names = dv_names;
+}
 
-	int err;
-	err = parse_arguments(argc, argv, &config);
-	if(err != 0) return err;
+int prepare_instance(FM95_Instance* inst) {
+	FM95_Config* config = &inst->config;
+	FM95_DeviceNames* dv_names = &inst->dv_names;
 
-	err = parse_config(&config, &dv_names);
+	int err = parse_config(config, dv_names, inst->name);
 	if(err != 0) {
 		printf("Could not parse the config file. (error code as return code)\n");
 		return err;
 	}
 
-	if(dv_names.input[0] == 0) {
+	if(dv_names->input[0] == 0) {
 		printf("Please set the input device");
 		return 1;
 	}
-	if(dv_names.output[0] == 0) {
+	if(dv_names->output[0] == 0) {
 		printf("Please set the output device");
 		return 1;
 	}
+	if(dv_names->socket[0] == 0) {
+		if(inst->name[0] == 0) strcpy(dv_names->socket, DEFAULT_SOCKET_PATH);
+		else snprintf(dv_names->socket, sizeof(dv_names->socket), "/etc/fm95/%s.socket", inst->name);
+	}
 
-	if (config.volumes.drive < 0.01f) config.volumes.drive = 0.01f;
+	if (config->volumes.drive < 0.01f) config->volumes.drive = 0.01f;
 
-	config.master_volume *= config.audio_deviation/75000.0f;
+	config->master_volume *= config->audio_deviation/75000.0f;
 
-	config.volumes.audio = calculate_sharedaudio_volume(config.volumes, config.rds_streams);
+	config->options.mpx_on = (strlen(dv_names->mpx) != 0);
+	config->options.sca_on = (strlen(dv_names->sca) != 0);
+	config->options.vban_in = is_vban_input(dv_names->input);
 
-	config.options.mpx_on = (strlen(dv_names.mpx) != 0);
+	config->volumes.audio = calculate_sharedaudio_volume(config->volumes, config->rds_streams, config->options.sca_on);
+	return 0;
+}
 
-	FM95_Runtime runtime;
-	memset(&runtime, 0, sizeof(runtime));
+static void pin_thread(pthread_t thread, int16_t cpu, const char* name) {
+	if(cpu < 0) return;
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int err = pthread_setaffinity_np(thread, sizeof(set), &set);
+	if(err != 0) fprintf(stderr, "Could not pin %s to CPU %d: %s\n", name[0] ? name : "fm95", cpu, strerror(err));
+}
+
+int run_instance(FM95_Instance* inst) {
+	FM95_Config* config = &inst->config;
+	FM95_Runtime* runtime = &inst->runtime;
 
-	err = setup_audio(&runtime, dv_names, config);
+	FM95_DeviceNames old_dv_names = inst->dv_names;
+
+	int err = setup_audio(runtime, inst->dv_names, *config);
 	if(err != 0) return err;
 
-	signal(SIGINT, stop);
-	signal(SIGTERM, stop);
-	signal(SIGHUP, reload);
+	init_runtime(runtime, *config);
 
-	init_runtime(&runtime, config);
+	if(init_telemetry(&inst->telemetry, inst->name) != 0) fprintf(stderr, "Could not set up telemetry.\n");
+	for(uint8_t i = 0; i < 4; i++) {
+		if(init_rds_ring(&inst->rds_rings[i], inst->name, i, config->rds_ring_mode) != 0) fprintf(stderr, "Could not set up RDS stream %u.\n", i);
+	}
 
-	FM95_RunResult runres;
-	memset(&runres, 0, sizeof(runres));
-	FM95_Data fmdata = {
-		.config = &config,
-		.runtime = &runtime,
-		.run_result = &runres
-	};
+	if(config->spectrum_size != 0 && init_spectrum_analyzer(&inst->spectrum, inst->name, config->spectrum_size, config->sample_rate, BUFFER_SIZE) != 0) fprintf(stderr, "Could not start the spectrum analyzer.\n");
+
+	if(config->bs412_log_path[0] != 0 && init_bs412_logger(&inst->bs412_log, config->bs412_log_path, config->bs412_log_resolution, config->bs412_log_days, config->sample_rate) != 0) fprintf(stderr, "Could not start the BS412 log.\n");
+
+	if(config->recorder_dir[0] != 0) {
+		char prefix[40];
+		snprintf(prefix, sizeof(prefix), "%s%smpx", inst->name, inst->name[0] ? "-" : "");
+		if(init_recorder(&inst->mpx_recorder, config->recorder_dir, prefix, 1, config->sample_rate, BUFFER_SIZE, config->recorder_segment, config->recorder_keep) != 0) fprintf(stderr, "Could not start the MPX recorder.\n");
+		if(config->recorder_input) {
+			snprintf(prefix, sizeof(prefix), "%s%sinput", inst->name, inst->name[0] ? "-" : "");
+			if(init_recorder(&inst->input_recorder, config->recorder_dir, prefix, 2, config->sample_rate, BUFFER_SIZE, config->recorder_segment, config->recorder_keep) != 0) fprintf(stderr, "Could not start the input recorder.\n");
+		}
+	}
 
 	ipc_ctx_t ctx;
 	ipc_ctx_t *pctx = &ctx;
-	if(create_ipc(pctx, handle_client, "/etc/fm95/ctl.socket", &fmdata) < 0) {
+	if(create_ipc(pctx, handle_command, inst->dv_names.socket, inst) < 0) {
 		printf("Could not create IPC.\n");
 		pctx = NULL;
 	}
 
+	// Only now, the helper threads above would inherit the core and fight the chain for it
+	pin_thread(pthread_self(), config->cpu, inst->name);
+
 	int ret;
 	while(true) {
-		ret = run_fm95(&config, &runtime, &runres);
-		if(to_reload) {
-			to_reload = 0;
+		ret = run_fm95(inst);
+		if(inst->to_reload) {
+			inst->to_reload = 0;
 			printf("Reloading...\n");
-			err = parse_config(&config, &dv_names);
+			err = parse_config(config, &inst->dv_names, inst->name);
 			if(err != 0) {
 				printf("Could not parse the config file. (error code as return code)\n");
-				return err;
+				ret = err;
+				cleanup_runtime(runtime, *config);
+				cleanup_audio_runtime(runtime, config->options);
+				break;
 			}
-			config.volumes.audio = calculate_sharedaudio_volume(config.volumes, config.rds_streams);
-			if(!compare_dvs(&dv_names, &old_dv_names)) printf("Warning! Audio Device name changes are not reloaded, please restart for that to take effect.\n");
-			old_dv_names = dv_names;
-			cleanup_runtime(&runtime, config);
-			init_runtime(&runtime, config);
-			to_run = 1;
+			config->volumes.audio = calculate_sharedaudio_volume(config->volumes, config->rds_streams, config->options.sca_on);
+			if(!compare_dvs(&inst->dv_names, &old_dv_names)) printf("Warning! Audio Device name changes are not reloaded, please restart for that to take effect.\n");
+			old_dv_names = inst->dv_names;
+			cleanup_runtime(runtime, *config);
+			init_runtime(runtime, *config);
+			inst->to_run = 1;
 			continue;
 		}
 		printf("Cleaning up...\n");
-		cleanup_runtime(&runtime, config);
-		cleanup_audio_runtime(&runtime, config.options);
+		cleanup_runtime(runtime, *config);
+		cleanup_audio_runtime(runtime, config->options);
 		break;
 	}
 	if(pctx != NULL) destroy_ipc(pctx);
+	exit_spectrum_analyzer(&inst->spectrum);
+	exit_bs412_logger(&inst->bs412_log);
+	exit_recorder(&inst->mpx_recorder);
+	exit_recorder(&inst->input_recorder);
+	exit_telemetry(&inst->telemetry);
+	for(uint8_t i = 0; i < 4; i++) exit_rds_ring(&inst->rds_rings[i]);
+	return ret;
+}
+
+static void *station_thread(void *arg) {
+	FM95_Instance* inst = (FM95_Instance*)arg;
+	inst->ret = run_instance(inst);
+	if(inst->ret != 0) fprintf(stderr, "Station %s exited with %d\n", inst->name, inst->ret);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	printf("fm95 (an FM Processor by radio95)\n");
+
+	FM95_Config config;
+	init_config(&config);
+
+	int err;
+	err = parse_arguments(argc, argv, &config);
+	if(err != 0) return err;
+
+	FM95_StationList stations;
+	err = find_stations(config.ini_config_path, &stations);
+	if(err != 0) {
+		printf("Could not parse the config file. (error code as return code)\n");
+		return err;
+	}
+
+	uint8_t count = stations.count ? stations.count : 1;
+	FM95_Instance* insts = calloc(count, sizeof(FM95_Instance));
+	if(insts == NULL) return 1;
+
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if(cpus < 1) cpus = 1;
+
+	for(uint8_t i = 0; i < count; i++) {
+		FM95_Instance* inst = &insts[i];
+		inst->config = config;
+		inst->to_run = 1;
+		if(stations.count) strcpy(inst->name, stations.names[i]);
+
+		err = prepare_instance(inst);
+		if(err != 0) {
+			if(stations.count) printf("Station %s is misconfigured.\n", inst->name);
+			free(insts);
+			return err;
+		}
+		if(stations.count && inst->config.cpu < 0) inst->config.cpu = i % cpus; // Spread the chains over the cores
+	}
+
+	instances = insts;
+	instance_count = count;
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGHUP, reload);
+
+	int ret = 0;
+	if(stations.count == 0) {
+		ret = run_instance(&insts[0]);
+	} else {
+		printf("Running %d stations\n", count);
+		for(uint8_t i = 0; i < count; i++) {
+			if(pthread_create(&insts[i].thread, NULL, station_thread, &insts[i]) != 0) {
+				fprintf(stderr, "Could not start station %s\n", insts[i].name);
+				insts[i].ret = 1;
+				insts[i].thread = 0;
+			}
+		}
+		for(uint8_t i = 0; i < count; i++) {
+			if(insts[i].thread) pthread_join(insts[i].thread, NULL);
+			if(insts[i].ret != 0) ret = insts[i].ret;
+		}
+	}
+
+	instance_count = 0;
+	free(insts);
 	return ret;
 }
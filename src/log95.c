@@ -0,0 +1,108 @@
+#define _GNU_SOURCE
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "bs412_log.h"
+
+void show_help(char *name) {
+	printf(
+		"Usage: \t%s [options] <log file>\n"
+		"Exports the BS412 log of fm95 as CSV\n"
+		"\t-s,--since\tFirst time to export, unix seconds or \"YYYY-MM-DD[ HH:MM:SS]\" local time [default: everything]\n"
+		"\t-u,--until\tLast time to export, same format [default: now]\n"
+		"\t-U,--utc\tPrint the times in UTC instead of local time\n"
+		,name
+	);
+}
+
+static int parse_time(const char* text, int64_t* out) {
+	char* end;
+	long long seconds = strtoll(text, &end, 10);
+	if(*end == '\0') {
+		*out = seconds;
+		return 0;
+	}
+
+	struct tm tm = {0};
+	tm.tm_isdst = -1;
+	end = strptime(text, "%Y-%m-%d", &tm);
+	if(end == NULL) return -1;
+	if(*end != '\0') {
+		end = strptime(end, " %H:%M:%S", &tm);
+		if(end == NULL || *end != '\0') return -1;
+	}
+	*out = mktime(&tm);
+	return 0;
+}
+
+int main(int argc, char **argv) {
+	int64_t since = INT64_MIN, until = INT64_MAX;
+	int utc = 0;
+
+	int opt;
+	const char *short_opt = "s:u:Uh";
+	struct option long_opt[] = {
+		{"since", required_argument, NULL, 's'},
+		{"until", required_argument, NULL, 'u'},
+		{"utc", no_argument, NULL, 'U'},
+		{"help", no_argument, NULL, 'h'},
+		{0, 0, 0, 0}
+	};
+
+	while((opt = getopt_long(argc, argv, short_opt, long_opt, NULL)) != -1) {
+		switch(opt) {
+			case 's':
+				if(parse_time(optarg, &since) != 0) {
+					fprintf(stderr, "Can't read the time %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'u':
+				if(parse_time(optarg, &until) != 0) {
+					fprintf(stderr, "Can't read the time %s\n", optarg);
+					return 1;
+				}
+				break;
+			case 'U':
+				utc = 1;
+				break;
+			case 'h':
+			default:
+				show_help(argv[0]);
+				return 1;
+		}
+	}
+	if(optind >= argc) {
+		show_help(argv[0]);
+		return 1;
+	}
+
+	Bs412LogFile log;
+	if(open_bs412_log_readonly(&log, argv[optind]) != 0) return 1;
+
+	// fm95 may be writing, so take the head once and stay behind it
+	uint64_t head = atomic_load_explicit(&log.header->head, memory_order_acquire);
+	uint64_t capacity = log.header->capacity;
+	uint64_t first = (head > capacity) ? head - capacity + 1 : 0; // the oldest slot could be rewritten while we read it
+
+	printf("time,unix,mpx_power_dbr,window_power_dbr,window_max_dbr,gain_mean,gain_min,partial_window\n");
+	for(uint64_t n = first; n < head; n++) {
+		Bs412LogRecord record = log.records[n % capacity];
+		if(record.time < since || record.time > until) continue;
+
+		time_t t = record.time;
+		struct tm tm;
+		if(utc) gmtime_r(&t, &tm);
+		else localtime_r(&t, &tm);
+		char stamp[32];
+		strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &tm);
+
+		printf("%s,%lld,%.2f,%.2f,%.2f,%.3f,%.3f,%d\n", stamp, (long long)record.time, record.mpx_power, record.window_power, record.window_max, record.gain_mean, record.gain_min, (record.flags & BS412_LOG_PARTIAL_WINDOW) ? 1 : 0);
+	}
+
+	close_bs412_log(&log);
+	return 0;
+}
@@ -1,5 +1,9 @@
 #include <getopt.h>
 #include <stdio.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <time.h>
+#include "ini.h"
 
 #define buffer_maxlength 12288
 #define buffer_tlength_fragsize 12288
@@ -9,14 +13,19 @@
 #define DEFAULT_DEVIATION 7000.0f
 #define DEFAULT_CLIPPER_THRESHOLD 1.0f
 
-#include "oscillator.h"
+#include "fm_modulator.h"
+#include "simd.h"
+#include "sample_format.h"
 
 #define DEFAULT_SAMPLE_RATE 192000
+#define DEFAULT_INPUT_RATE 16000 // Sets the width of the SCA channel too, +-8 khz around the carrier here
 
 #define INPUT_DEVICE "SCA.monitor"
 #define OUTPUT_DEVICE "FM_MPX"
 
-#define BUFFER_SIZE 2048
+#define BUFFER_SIZE 2048 // Output samples per block, rounded down to a whole number of input samples of every carrier
+
+#define MAX_CARRIERS 8
 
 #include "audio.h"
 
@@ -26,21 +35,50 @@
 
 static volatile sig_atomic_t to_run = 1;
 
-inline float hard_clip(float sample, float threshold) { return fmaxf(-threshold, fminf(threshold, sample)); }
-
 typedef struct {
+	char name[32];
+	char input[64];
 	float freq;
 	float deviation;
 	float clipper;
-	float volume;
 	float master_volume;
 	float audio_volume;
+	uint32_t input_rate;
+} Sca95_Carrier;
+typedef struct {
+	Sca95_Carrier carriers[MAX_CARRIERS];
+	uint8_t carrier_count;
 	uint32_t sample_rate;
+	bool threads;
+	uint8_t output_format; // one of SAMPLE_*
+	bool dither;
+	char output[64];
+	char ini_config_path[64];
 } Sca95_Config;
+
+struct Sca95_Runtime;
 typedef struct
 {
 	PulseInputDevice input;
+	FMUpconverter mod;
+	const Sca95_Carrier* config;
+	struct Sca95_Runtime* parent;
+	size_t input_size;
+	float audio_input[BUFFER_SIZE];
+	float output[BUFFER_SIZE];
+	pthread_t thread;
+} Sca95_CarrierRuntime;
+typedef struct Sca95_Runtime
+{
+	Sca95_CarrierRuntime carriers[MAX_CARRIERS];
+	uint8_t carrier_count;
 	PulseOutputDevice output;
+	size_t output_size;
+	SampleDither dither;
+	uint8_t output_bytes[BUFFER_SIZE * 4];
+	pthread_barrier_t start, done;
+	pthread_mutex_t launch; // held while the workers are being created
+	volatile bool go;
 } Sca95_Runtime;
 
 static void stop(int signum) {
@@ -52,6 +90,7 @@ static void stop(int signum) {
 void show_help(char *name) {
 	printf(
 		"Usage: \t%s\n"
+		"\t-c,--config\tRead the carriers from this config, -i -f -F -C -A -v -r are then ignored, -o -O -D still apply unless its [sca95] sets them\n"
 		"\t-i,--input\tOverride input device [default: %s]\n"
 		"\t-o,--output\tOverride output device [default: %s]\n"
 		"\t-f,--sca_freq\tOverride the SCA frequency [default: %.1f]\n"
@@ -59,6 +98,9 @@ void show_help(char *name) {
 		"\t-C,--sca_clip\tOverride the SCA clipper threshold [default: %.2f]\n"
 		"\t-A,--master_vol\tSet master volume [default: %.3f]\n"
 		"\t-v,--volume\tSet audio volume [default: %.3f]\n"
+		"\t-r,--input_rate\tSet the input sample rate, must divide %d [default: %d]\n"
+		"\t-O,--format\tOutput sample format, u8, s16, s24, s32 or f32 [default: f32]\n"
+		"\t-D,--no_dither\tDo not dither the integer output formats\n"
 		,name
 		,INPUT_DEVICE
 		,OUTPUT_DEVICE
@@ -67,78 +109,287 @@ void show_help(char *name) {
 		,DEFAULT_CLIPPER_THRESHOLD
 		,DEFAULT_VOLUME
 		,DEFAULT_AUDIO_VOLUME
+		,DEFAULT_SAMPLE_RATE
+		,DEFAULT_INPUT_RATE
 	);
 }
 
-typedef struct {
-	float frequency;
-	float deviation;
-	float osc_phase;
-	float sample_rate;
-} FMModulator;
-
-void init_fm_modulator(FMModulator *fm, float frequency, float deviation, float sample_rate) {
-	fm->frequency = frequency;
-	fm->deviation = deviation;
-	fm->sample_rate = sample_rate;
-	fm->osc_phase = 0.0f;
+static void init_carrier(Sca95_Carrier* carrier) {
+	*carrier = (Sca95_Carrier){
+		.name = "sca",
+		.input = INPUT_DEVICE,
+		.freq = DEFAULT_FREQUENCY,
+		.deviation = DEFAULT_DEVIATION,
+		.clipper = DEFAULT_CLIPPER_THRESHOLD,
+		.master_volume = DEFAULT_VOLUME,
+		.audio_volume = DEFAULT_AUDIO_VOLUME,
+		.input_rate = DEFAULT_INPUT_RATE
+	};
 }
 
-float modulate_fm(FMModulator *fm, float sample) {
-	float inst_freq = fm->frequency+(sample*fm->deviation);
-	fm->osc_phase += (M_2PI * inst_freq) / fm->sample_rate;
-	fm->osc_phase -= (fm->osc_phase >= M_2PI) ? M_2PI : 0.0f;
-	return sinf(fm->osc_phase);
+// Reads and modulates one block of a carrier, returns non zero on a read error
+static int process_carrier(Sca95_CarrierRuntime* carrier) {
+	int pulse_error;
+	if((pulse_error = read_PulseInputDevice(&carrier->input, carrier->audio_input, carrier->input_size * sizeof(float)))) {
+		fprintf(stderr, "Error reading from input device of %s: %s\n", carrier->config->name, pa_strerror(pulse_error));
+		return pulse_error;
+	}
+	upconvert_fm_block(&carrier->mod, carrier->audio_input, carrier->output, carrier->input_size, carrier->config->audio_volume, carrier->config->clipper, carrier->config->master_volume);
+	return 0;
 }
 
-int run_sca95(const Sca95_Config config, Sca95_Runtime* runtime) {
-	FMModulator sca_mod;
-	init_fm_modulator(&sca_mod, config.freq, config.deviation, config.sample_rate);
+static void *carrier_worker(void *arg) {
+	Sca95_CarrierRuntime* carrier = (Sca95_CarrierRuntime*)arg;
+	Sca95_Runtime* runtime = carrier->parent;
 
-	int pulse_error;
+	// Nothing touches the barriers before every worker is up, if one could not be created the rest just leave
+	pthread_mutex_lock(&runtime->launch);
+	pthread_mutex_unlock(&runtime->launch);
+	if(!runtime->go) return NULL;
 
-	float audio_input[BUFFER_SIZE];
+	while(true) {
+		pthread_barrier_wait(&runtime->start);
+		if(!runtime->go) break;
+		if(process_carrier(carrier) != 0) to_run = 0;
+		pthread_barrier_wait(&runtime->done);
+	}
+	return NULL;
+}
+
+// Starts a worker per carrier, false when one of them could not be created, the ones that were are joined again then
+static bool start_carrier_threads(Sca95_Runtime* runtime) {
+	uint8_t started = 0;
+	int err = 0;
+
+	runtime->go = false;
+	pthread_mutex_init(&runtime->launch, NULL);
+	pthread_mutex_lock(&runtime->launch);
+	for(; started < runtime->carrier_count; started++) {
+		err = pthread_create(&runtime->carriers[started].thread, NULL, carrier_worker, &runtime->carriers[started]);
+		if(err != 0) break;
+	}
+
+	if(err == 0) {
+		pthread_barrier_init(&runtime->start, NULL, runtime->carrier_count + 1);
+		pthread_barrier_init(&runtime->done, NULL, runtime->carrier_count + 1);
+		runtime->go = true;
+	} else fprintf(stderr, "Could not start a thread for %s: %s\n", runtime->carriers[started].config->name, strerror(err));
+	pthread_mutex_unlock(&runtime->launch);
+
+	if(err != 0) {
+		for(uint8_t i = 0; i < started; i++) pthread_join(runtime->carriers[i].thread, NULL);
+		pthread_mutex_destroy(&runtime->launch);
+		return false;
+	}
+	return true;
+}
+
+int run_sca95(const Sca95_Config* config, Sca95_Runtime* runtime) {
+	int pulse_error;
 	float output[BUFFER_SIZE];
 
+	bool threads = config->threads;
+	if(threads && !start_carrier_threads(runtime)) {
+		fprintf(stderr, "Running the carriers on one thread.\n");
+		threads = false;
+	}
+
+	size_t vn = runtime->output_size & ~(size_t)3;
+
 	while (to_run) {
-		if((pulse_error = read_PulseInputDevice(&runtime->input, audio_input, sizeof(audio_input)))) {
-			fprintf(stderr, "Error reading from input device: %s\n", pa_strerror(pulse_error));
-			to_run = 0;
-			break;
+		if(threads) {
+			runtime->go = true;
+			pthread_barrier_wait(&runtime->start);
+			pthread_barrier_wait(&runtime->done);
+			if(!to_run) break;
+		} else {
+			for(uint8_t i = 0; i < runtime->carrier_count; i++) {
+				if(process_carrier(&runtime->carriers[i]) != 0) to_run = 0;
+			}
+			if(!to_run) break;
 		}
 
-		for (uint16_t i = 0; i < BUFFER_SIZE; i++) {
-			output[i] = modulate_fm(&sca_mod, hard_clip(audio_input[i]*config.audio_volume, config.clipper))*config.master_volume;
+		memcpy(output, runtime->carriers[0].output, runtime->output_size * sizeof(float));
+		for(uint8_t c = 1; c < runtime->carrier_count; c++) {
+			const float* carrier = runtime->carriers[c].output;
+			for(size_t i = 0; i < vn; i += 4) v4sf_store(output + i, v4sf_load(output + i) + v4sf_load(carrier + i));
+			for(size_t i = vn; i < runtime->output_size; i++) output[i] += carrier[i];
 		}
 
-		if((pulse_error = write_PulseOutputDevice(&runtime->output, output, sizeof(output)))) {
+		void* out = output;
+		if(config->output_format != SAMPLE_F32) {
+			encode_samples(output, runtime->output_bytes, runtime->output_size, config->output_format, config->dither ? &runtime->dither : NULL);
+			out = runtime->output_bytes;
+		}
+		if((pulse_error = write_PulseOutputDevice(&runtime->output, out, runtime->output_size * sample_format_bytes[config->output_format]))) {
 			fprintf(stderr, "Error writing to output device: %s\n", pa_strerror(pulse_error));
 			to_run = 0;
 			break;
 		}
 	}
+
+	if(threads) {
+		runtime->go = false;
+		pthread_barrier_wait(&runtime->start);
+		for(uint8_t i = 0; i < runtime->carrier_count; i++) pthread_join(runtime->carriers[i].thread, NULL);
+		pthread_barrier_destroy(&runtime->start);
+		pthread_barrier_destroy(&runtime->done);
+		pthread_mutex_destroy(&runtime->launch);
+	}
+	return 0;
+}
+
+static int config_handler(void* user, const char* section, const char* name, const char* value) {
+	Sca95_Config* pconfig = (Sca95_Config*)user;
+
+	#define MATCH(s, n) strcmp(section, s) == 0 && strcmp(name, n) == 0
+
+	if(MATCH("sca95", "output")) {
+		strncpy(pconfig->output, value, 63);
+		pconfig->output[63] = '\0';
+		return 1;
+	} else if(MATCH("sca95", "sample_rate")) {
+		pconfig->sample_rate = strtoul(value, NULL, 10);
+		return 1;
+	} else if(MATCH("sca95", "threads")) {
+		pconfig->threads = atoi(value);
+		return 1;
+	} else if(MATCH("sca95", "output_format")) {
+		int format = parse_sample_format(value);
+		if(format < 0) return 0;
+		pconfig->output_format = format;
+		return 1;
+	} else if(MATCH("sca95", "dither")) {
+		pconfig->dither = atoi(value);
+		return 1;
+	} else if(strcmp(section, "sca95") == 0) return 0;
+
+	// Every other section is a carrier, named by the section
+	Sca95_Carrier* carrier = NULL;
+	for(uint8_t i = 0; i < pconfig->carrier_count; i++) {
+		if(strcmp(pconfig->carriers[i].name, section) == 0) carrier = &pconfig->carriers[i];
+	}
+	if(carrier == NULL) {
+		if(pconfig->carrier_count >= MAX_CARRIERS || strlen(section) >= sizeof(carrier->name)) return 0;
+		carrier = &pconfig->carriers[pconfig->carrier_count++];
+		init_carrier(carrier);
+		strcpy(carrier->name, section);
+	}
+
+	if(strcmp(name, "input") == 0) {
+		strncpy(carrier->input, value, 63);
+		carrier->input[63] = '\0';
+	} else if(strcmp(name, "frequency") == 0) carrier->freq = strtof(value, NULL);
+	else if(strcmp(name, "deviation") == 0) carrier->deviation = strtof(value, NULL);
+	else if(strcmp(name, "clipper") == 0) carrier->clipper = strtof(value, NULL);
+	else if(strcmp(name, "volume") == 0) carrier->master_volume = strtof(value, NULL);
+	else if(strcmp(name, "audio_volume") == 0) carrier->audio_volume = strtof(value, NULL);
+	else if(strcmp(name, "input_rate") == 0) carrier->input_rate = strtoul(value, NULL, 10);
+	else return 0;
+
+	return 1;
+}
+
+static size_t gcd(size_t a, size_t b) {
+	while(b != 0) {
+		size_t t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+void cleanup_runtime(Sca95_Runtime* runtime) {
+	for(uint8_t i = 0; i < runtime->carrier_count; i++) {
+		if(runtime->carriers[i].input.initialized) free_PulseDevice(&runtime->carriers[i].input);
+		exit_fm_upconverter(&runtime->carriers[i].mod);
+	}
+	if(runtime->output.initialized) free_PulseDevice(&runtime->output);
+}
+
+int setup_runtime(const Sca95_Config* config, Sca95_Runtime* runtime) {
+	// All the carriers have to fill the same output block
+	size_t block_lcm = 1;
+	for(uint8_t i = 0; i < config->carrier_count; i++) {
+		const Sca95_Carrier* carrier = &config->carriers[i];
+		if(carrier->input_rate == 0 || carrier->input_rate > config->sample_rate || config->sample_rate % carrier->input_rate != 0) {
+			fprintf(stderr, "Error: the input rate of %s has to divide %d\n", carrier->name, config->sample_rate);
+			return 1;
+		}
+		size_t interpolation = config->sample_rate / carrier->input_rate;
+		block_lcm = block_lcm / gcd(block_lcm, interpolation) * interpolation;
+	}
+	if(block_lcm > BUFFER_SIZE) {
+		fprintf(stderr, "Error: the input rates have no common block size\n");
+		return 1;
+	}
+	runtime->output_size = (BUFFER_SIZE / block_lcm) * block_lcm;
+
+	pa_buffer_attr output_buffer_atr = {
+		.maxlength = buffer_maxlength,
+		.tlength = buffer_tlength_fragsize,
+		.prebuf = buffer_prebuf
+	};
+
+	int opentime_pulse_error;
+
+	for(uint8_t i = 0; i < config->carrier_count; i++) {
+		const Sca95_Carrier* carrier = &config->carriers[i];
+		Sca95_CarrierRuntime* rt = &runtime->carriers[i];
+		rt->config = carrier;
+		rt->parent = runtime;
+		runtime->carrier_count = i + 1;
+
+		if(init_fm_upconverter(&rt->mod, carrier->freq, carrier->deviation, carrier->input_rate, config->sample_rate) != 0) {
+			fprintf(stderr, "Error: could not set up the modulator of %s\n", carrier->name);
+			return 1;
+		}
+		rt->input_size = runtime->output_size / rt->mod.interpolation;
+
+		pa_buffer_attr input_buffer_atr = {
+			.maxlength = buffer_maxlength,
+			.fragsize = rt->input_size * sizeof(float)
+		};
+
+		printf("Connecting to input device of %s at %.1f Hz... (%s)\n", carrier->name, carrier->freq, carrier->input);
+		opentime_pulse_error = init_PulseInputDevice(&rt->input, carrier->input_rate, 1, "sca95", carrier->name, carrier->input, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
+		if (opentime_pulse_error) {
+			fprintf(stderr, "Error: cannot open input device: %s\n", pa_strerror(opentime_pulse_error));
+			return 1;
+		}
+	}
+
+	printf("Connecting to output device... (%s)\n", config->output);
+
+	init_sample_dither(&runtime->dither, (uint32_t)time(NULL));
+	opentime_pulse_error = init_PulseOutputDevice(&runtime->output, config->sample_rate, 1, "sca95", "Signal Output", config->output, &output_buffer_atr, pulse_sample_format(config->output_format));
+	if (opentime_pulse_error) {
+		fprintf(stderr, "Error: cannot open output device: %s\n", pa_strerror(opentime_pulse_error));
+		return 1;
+	}
 	return 0;
 }
 
 int main(int argc, char **argv) {
-	printf("sca95 (a SCA modulator by radio95) version 1.1\n");
+	printf("sca95 (a SCA modulator by radio95) version 1.3\n");
 
 	Sca95_Config config = {
-		.freq = DEFAULT_FREQUENCY,
-		.deviation = DEFAULT_DEVIATION,
-		.clipper = DEFAULT_CLIPPER_THRESHOLD,
-		.master_volume = DEFAULT_VOLUME,
-		.audio_volume = DEFAULT_AUDIO_VOLUME,
-		.sample_rate = DEFAULT_SAMPLE_RATE
+		.carrier_count = 1,
+		.sample_rate = DEFAULT_SAMPLE_RATE,
+		.threads = false,
+		.output_format = SAMPLE_F32,
+		.dither = true,
+		.output = OUTPUT_DEVICE,
+		.ini_config_path = ""
 	};
-
-	char audio_input_device[64] = INPUT_DEVICE;
-	char audio_output_device[64] = OUTPUT_DEVICE;
+	Sca95_Carrier* cli = &config.carriers[0];
+	init_carrier(cli);
 
 	int opt;
-	const char	*short_opt = "i:o:f:F:C:A:v:h";
+	const char	*short_opt = "c:i:o:f:F:C:A:v:r:O:Dh";
 	struct option	long_opt[] =
 	{
+		{"config",      required_argument, NULL, 'c'},
 		{"input",       required_argument, NULL, 'i'},
 		{"output",      required_argument, NULL, 'o'},
 		{"sca_freq",    required_argument, NULL, 'f'},
@@ -147,6 +398,9 @@ int main(int argc, char **argv) {
 		{"master_vol",     required_argument,       NULL, 'A'},
 		{"output",     required_argument,       NULL, 'A'},
 		{"audio_vol",     required_argument,       NULL, 'v'},
+		{"input_rate",    required_argument, NULL, 'r'},
+		{"format",      required_argument, NULL, 'O'},
+		{"no_dither",   no_argument,       NULL, 'D'},
 
 		{"help",        no_argument,       NULL, 'h'},
 		{0,             0,                 0,    0}
@@ -154,26 +408,44 @@ int main(int argc, char **argv) {
 
 	while((opt = getopt_long(argc, argv, short_opt, long_opt, NULL)) != -1) {
 		switch(opt) {
+			case 'c': // Config
+				strncpy(config.ini_config_path, optarg, sizeof(config.ini_config_path) - 1);
+				break;
 			case 'i': // Input Device
-				memcpy(audio_input_device, optarg, 47);
+				strncpy(cli->input, optarg, sizeof(cli->input) - 1);
 				break;
 			case 'o': // Output Device
-				memcpy(audio_output_device, optarg, 47);
+				strncpy(config.output, optarg, sizeof(config.output) - 1);
 				break;
 			case 'f': //SCA freq
-				config.freq = strtof(optarg, NULL);
+				cli->freq = strtof(optarg, NULL);
 				break;
 			case 'F': //SCA deviation
-				config.deviation = strtof(optarg, NULL);
+				cli->deviation = strtof(optarg, NULL);
 				break;
 			case 'C': //SCA clip
-				config.clipper = strtof(optarg, NULL);
+				cli->clipper = strtof(optarg, NULL);
 				break;
 			case 'A': // Master vol
-				config.master_volume = strtof(optarg, NULL);
+				cli->master_volume = strtof(optarg, NULL);
 				break;
 			case 'v': // Audio Volume
-				config.audio_volume = strtof(optarg, NULL);
+				cli->audio_volume = strtof(optarg, NULL);
+				break;
+			case 'r': // Input rate
+				cli->input_rate = strtoul(optarg, NULL, 10);
+				break;
+			case 'O': { // Output format
+				int format = parse_sample_format(optarg);
+				if(format < 0) {
+					fprintf(stderr, "Unknown output format: %s\n", optarg);
+					return 1;
+				}
+				config.output_format = format;
+				break;
+			}
+			case 'D': // No dither
+				config.dither = false;
 				break;
 			case 'h':
 				show_help(argv[0]);
@@ -181,43 +453,34 @@ int main(int argc, char **argv) {
 		}
 	}
 
-	pa_buffer_attr input_buffer_atr = {
-		.maxlength = buffer_maxlength,
-		.fragsize = buffer_tlength_fragsize
-	};
-	pa_buffer_attr output_buffer_atr = {
-		.maxlength = buffer_maxlength,
-		.tlength = buffer_tlength_fragsize,
-		.prebuf = buffer_prebuf
-	};
-
-	int opentime_pulse_error;
-
-	Sca95_Runtime runtime;
-	memset(&runtime, 0, sizeof(runtime));
-
-	printf("Connecting to input device... (%s)\n", audio_input_device);
-	opentime_pulse_error = init_PulseInputDevice(&runtime.input, config.sample_rate, 1, "sca95", "Main Audio Input", audio_input_device, &input_buffer_atr, PA_SAMPLE_FLOAT32NE);
-	if (opentime_pulse_error) {
-		fprintf(stderr, "Error: cannot open input device: %s\n", pa_strerror(opentime_pulse_error));
-		return 1;
+	if(config.ini_config_path[0] != 0) {
+		config.carrier_count = 0;
+		int err = ini_parse(config.ini_config_path, &config_handler, &config);
+		if(err != 0) {
+			printf("Could not parse the config file. (error code as return code)\n");
+			return err;
+		}
+		if(config.carrier_count == 0) {
+			printf("The config has no carriers.\n");
+			return 1;
+		}
 	}
 
-	printf("Connecting to output device... (%s)\n", audio_output_device);
+	Sca95_Runtime* runtime = calloc(1, sizeof(Sca95_Runtime));
+	if(runtime == NULL) return 1;
 
-	opentime_pulse_error = init_PulseOutputDevice(&runtime.output, config.sample_rate, 1, "sca95", "Signal Output", audio_output_device, &output_buffer_atr, PA_SAMPLE_FLOAT32NE);
-	if (opentime_pulse_error) {
-		fprintf(stderr, "Error: cannot open output device: %s\n", pa_strerror(opentime_pulse_error));
-		free_PulseDevice(&runtime.input);
+	if(setup_runtime(&config, runtime) != 0) {
+		cleanup_runtime(runtime);
+		free(runtime);
 		return 1;
 	}
 
 	signal(SIGINT, stop);
 	signal(SIGTERM, stop);
 
-	int ret = run_sca95(config, &runtime);
+	int ret = run_sca95(&config, runtime);
 	printf("Cleaning up...\n");
-	free_PulseDevice(&runtime.input);
-	free_PulseDevice(&runtime.output);
+	cleanup_runtime(runtime);
+	free(runtime);
 	return ret;
-}
\ No newline at end of file
+}
@@ -1,10 +1,14 @@
+#define _GNU_SOURCE
 #include <unistd.h>
 #include <arpa/inet.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
 #include <getopt.h>
 #include <pwd.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 
 #define buffer_maxlength 12288
 #define buffer_tlength_fragsize 12288
@@ -13,76 +17,112 @@
 #include "audio.h"
 #include "debug.h"
 #include "vban.h"
+#include "jitter_buffer.h"
+#include "sample_format.h"
+#include "asrc.h"
 
 #define BUF_SIZE 1500
-#define MAX_AUDIO_DATA_SIZE (BUF_SIZE - sizeof(VBANHeader))
-#define MAX_BUFFER_PACKETS 24
+#define MAX_BUFFER_PACKETS 64 // the jitter buffer holds more for fm95's vban input, -b stays where it was
+#define DEFAULT_MIN_BUFFER 2
 
-#define POLL_TIMEOUT_MS 75
+#define WRITE_MIN_BYTES 1024 // tiny packets get written together
+#define WRITER_WAIT_MS 100
+
+// Drift loop on the buffer depth in seconds, settles in a few minutes which is plenty for clock drift
+#define DRIFT_KP 0.028
+#define DRIFT_KI 4e-4
+#define DRIFT_SMOOTHING 2.0
+#define DRIFT_REPORT_INTERVAL 60.0
+
+#define DEFAULT_OUTPUT_RATE 48000
+#define DEFAULT_OUTPUT_CHANNELS 2
+#define RESAMPLED_FRAMES 2048 // per resampler pass, going up in rate takes several
+
+#define MAX_STREAMS 16
+#define STREAM_TABLE_SIZE 32 // power of two, at least twice MAX_STREAMS so the probes stay short
+
+#define VBAN_MAX_SAMPLES 256 // samples_per_frame is stored minus one in a byte
+#define VBAN_MAX_PAYLOAD 1436 // the protocol's limit
+#define SEND_BATCH 16
+#define SEND_BATCH_SECONDS 0.01 // don't hold audio back longer than this to batch it
+
+#define RECV_BATCH 32 // datagrams taken per recvmmsg
+#define EPOLL_TIMEOUT_MS 500 // only so that we can notice the stop signal
 
 typedef struct {
-    char data[MAX_AUDIO_DATA_SIZE];
-    size_t size;
-} AudioPacket;
+    JitterBuffer jitter;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    // Set by the receiver when the stream's format changes, the writer then reopens the output
+    bool reconfigure;
+    uint8_t sr_idx;
+    uint8_t format;
+    uint8_t channels;
+    double packet_duration;
+
+    // The output format never changes, whatever comes in is converted to it
+    uint32_t out_rate;
+    uint8_t out_channels;
+    const int16_t* explicit_map;
+    ChannelMap map;
+    Asrc asrc;
+    DriftEstimator drift;
+
+    char stream_name[sizeof(((VBANHeader*)0)->streamname) + 1];
+    char device[64];
+    struct in_addr remote;
+    pa_buffer_attr buffer_attr;
+    PulseOutputDevice output;
+    pthread_t writer;
+    int quiet;
+
+    // Only touched by the receiver
+    uint8_t last_sr;
+    uint8_t last_format;
+    uint8_t last_channels;
+    bool audio_reset;
+    uint8_t last_target;
+} Vban95_Stream;
 
 typedef struct {
-    AudioPacket* packets;
-    int capacity;
-    int head;
-    int tail;
-    int count;
-    VBANHeader header;
-} AudioBuffer;
-
-AudioBuffer* create_audio_buffer(int capacity) {
-    AudioBuffer* buffer = (AudioBuffer*)malloc(sizeof(AudioBuffer));
-    if (!buffer) {
-        perror("Failed to allocate audio buffer");
-        return NULL;
-    }
-
-    buffer->packets = (AudioPacket*)malloc(capacity * sizeof(AudioPacket));
-    if (!buffer->packets) {
-        perror("Failed to allocate packet buffer");
-        free(buffer);
-        return NULL;
-    }
-
-    buffer->capacity = capacity;
-    buffer->head = 0;
-    buffer->tail = 0;
-    buffer->count = 0;
-
-    return buffer;
+    Vban95_Stream streams[MAX_STREAMS];
+    uint8_t count;
+    Vban95_Stream* table[STREAM_TABLE_SIZE];
+} Vban95_Streams;
+
+static uint32_t stream_hash(const char* name) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < sizeof(((VBANHeader*)0)->streamname) && name[i] != '\0'; i++) {
+        hash ^= (uint8_t)name[i];
+        hash *= 16777619u;
+    }
+    return hash;
 }
 
-void destroy_audio_buffer(AudioBuffer* buffer) {
-    if (buffer) {
-        free(buffer->packets);
-        free(buffer);
-    }
+static bool stream_name_equal(const char* a, const char* b) {
+    return strncmp(a, b, sizeof(((VBANHeader*)0)->streamname)) == 0;
 }
 
-int add_to_buffer(AudioBuffer* buffer, const char* data, size_t size, const VBANHeader* header) {
-    if (size > MAX_AUDIO_DATA_SIZE) {
-        fprintf(stderr, "Audio data too large for buffer\n");
-        return -1;
+static int add_stream(Vban95_Streams* streams, Vban95_Stream* stream) {
+    for (uint32_t i = stream_hash(stream->stream_name), n = 0; n < STREAM_TABLE_SIZE; i++, n++) {
+        Vban95_Stream** slot = &streams->table[i & (STREAM_TABLE_SIZE - 1)];
+        if (*slot == NULL) {
+            *slot = stream;
+            return 0;
+        }
+        if (stream_name_equal((*slot)->stream_name, stream->stream_name)) return -1;
     }
+    return -1;
+}
 
-    if (buffer->count == buffer->capacity) {
-        buffer->tail = (buffer->tail + 1) % buffer->capacity;
-        buffer->count--;
+static Vban95_Stream* find_stream(Vban95_Streams* streams, const char* name) {
+    for (uint32_t i = stream_hash(name), n = 0; n < STREAM_TABLE_SIZE; i++, n++) {
+        Vban95_Stream* stream = streams->table[i & (STREAM_TABLE_SIZE - 1)];
+        if (stream == NULL) return NULL;
+        if (stream_name_equal(stream->stream_name, name)) return stream;
     }
-
-    AudioPacket* pkt = &buffer->packets[buffer->head];
-    memcpy(pkt->data, data, size);
-    pkt->size = size;
-    memcpy(&buffer->header, header, sizeof(VBANHeader));
-
-    buffer->head = (buffer->head + 1) % buffer->capacity;
-    buffer->count++;
-
-    return 1;
+    return NULL;
 }
 
 volatile uint8_t to_run = 1;
@@ -93,26 +133,348 @@ static void stop(int signum) {
     to_run = 0;
 }
 
-static PulseOutputDevice output = {0};
+// Pulls from the jitter buffer at the pace the output device takes the audio, one per stream so a stuck device only stalls its own
+static void* writer_thread(void* arg) {
+    Vban95_Stream* stream = arg;
+    PulseOutputDevice* output = &stream->output;
+    uint8_t oc = stream->out_channels;
+    char write_buffer[WRITE_MIN_BYTES + JITTER_MAX_PAYLOAD];
+    double since_report = 0;
+
+    float* decoded = malloc((WRITE_MIN_BYTES + JITTER_MAX_PAYLOAD) * sizeof(float));
+    float* remapped = malloc((WRITE_MIN_BYTES + JITTER_MAX_PAYLOAD) * oc * sizeof(float));
+    float* resampled = malloc(RESAMPLED_FRAMES * oc * sizeof(float));
+    if (decoded == NULL || remapped == NULL || resampled == NULL || init_asrc(&stream->asrc, oc) != 0) {
+        fprintf(stderr, "%s: failed to allocate the conversion buffers\n", stream->stream_name);
+        goto exit;
+    }
+
+    int result = init_PulseOutputDevice(output, stream->out_rate, oc, "vban95", stream->stream_name, stream->device, &stream->buffer_attr, PA_SAMPLE_FLOAT32NE);
+    if (result != 0) {
+        fprintf(stderr, "Failed to initialize PulseAudio output device for %s: %s\n", stream->stream_name, pa_strerror(result));
+        goto exit;
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    while (to_run) {
+        if (stream->reconfigure) {
+            stream->reconfigure = false;
+            if (init_channel_map(&stream->map, stream->channels + 1, oc, stream->explicit_map) != 0) fprintf(stderr, "%s: can't map %d channels\n", stream->stream_name, stream->channels + 1);
+            set_asrc_nominal(&stream->asrc, (double)VBAN_SRList[stream->sr_idx] / stream->out_rate);
+            init_drift_estimator(&stream->drift, DRIFT_KP, DRIFT_KI, DRIFT_SMOOTHING);
+            continue;
+        }
+
+        double fill = jitter_buffer_fill(&stream->jitter) * stream->packet_duration;
+        bool playing = stream->jitter.playing;
+        size_t size = pop_jitter_buffer(&stream->jitter, write_buffer);
+        if (size == 0 || stream->map.in_channels == 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += WRITER_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&stream->cond, &stream->lock, &deadline);
+            continue;
+        }
+        while (size < WRITE_MIN_BYTES && jitter_buffer_ready(&stream->jitter)) size += pop_jitter_buffer(&stream->jitter, write_buffer + size);
+
+        uint8_t format = stream->format;
+        uint16_t in_channels = stream->map.in_channels;
+        size_t frames = size / sample_format_bytes[format] / in_channels;
+        double dt = frames / (double)VBAN_SRList[stream->sr_idx];
+        double target = stream->jitter.target_depth * stream->packet_duration;
+        if (playing) set_asrc_ratio(&stream->asrc, update_drift_estimator(&stream->drift, fill, target, dt));
+        pthread_mutex_unlock(&stream->lock);
+
+        decode_samples(write_buffer, decoded, frames * in_channels, format);
+        remap_channels(&stream->map, decoded, remapped, frames);
+        for (size_t done = 0; done < frames;) {
+            size_t piece = (size_t)((RESAMPLED_FRAMES - 4) * stream->asrc.ratio);
+            if (piece == 0) piece = 1;
+            if (piece > frames - done) piece = frames - done;
+            size_t out_frames = process_asrc(&stream->asrc, remapped + done * oc, piece, resampled, RESAMPLED_FRAMES);
+            write_PulseOutputDevice(output, resampled, out_frames * oc * sizeof(float));
+            done += piece;
+        }
+
+        since_report += dt;
+        if (since_report >= DRIFT_REPORT_INTERVAL) {
+            since_report = 0;
+            if (stream->quiet == 0) printf("%s: sender clock is %+.1f ppm off ours, buffer at %.1f ms\n", stream->stream_name, stream->drift.integral * 1e6, stream->drift.fill * 1000.0);
+        }
+
+        pthread_mutex_lock(&stream->lock);
+    }
+    pthread_mutex_unlock(&stream->lock);
+
+exit:
+    free(decoded);
+    free(remapped);
+    free(resampled);
+    return NULL;
+}
+
+static void send_ping_reply(int sockfd, const VBANHeader* ping, const struct sockaddr_in* sender_addr, socklen_t sender_len, int listen_port, int quiet) {
+    VBANPing0DataUnion ping_data;
+    memset(&ping_data, 0, sizeof(VBANPing0Data));
+
+    ping_data.data.bitType = VBANPING_TYPE_RECEPTOR;
+    ping_data.data.bitfeature = VBANPING_FEATURE_AUDIO | VBANPING_FEATURE_AOIP;
+    ping_data.data.nVersion[0] = 1;
+    ping_data.data.nVersion[1] = 1;
+
+    snprintf(ping_data.data.DistantIP_ascii, sizeof(ping_data.data.DistantIP_ascii), "%s", inet_ntoa(sender_addr->sin_addr));
+    ping_data.data.DistantPort = htons(listen_port);
+    strncpy(ping_data.data.ApplicationName_ascii, "vban95", sizeof(ping_data.data.ApplicationName_ascii));
+
+    uid_t uid = getuid();
+    struct passwd *pw = getpwuid(uid);
+    if (pw != NULL) snprintf(ping_data.data.UserName_utf8, sizeof(ping_data.data.UserName_utf8), "%s", pw->pw_name);
+
+    gethostname(ping_data.data.HostName_ascii, sizeof(ping_data.data.HostName_ascii));
+
+    VBANHeaderUnion reply_header;
+    memset(&reply_header, 0, sizeof(VBANHeader));
+
+    memcpy(reply_header.packet_data.vban, "VBAN", 4);
+    reply_header.packet_data.protocol_sample_rate_idx = VBAN_PROTOCOL_SERVICE;
+    reply_header.packet_data.sample_channels = VBAN_SERVICE_IDENTIFICATION;
+    reply_header.packet_data.samples_per_frame = 0x80; // reply
+    reply_header.packet_data.frame_num = ping->frame_num;
+
+    char reply_buffer[sizeof(VBANHeader) + sizeof(VBANPing0Data)];
+    memcpy(reply_buffer, &reply_header.raw_data, sizeof(VBANHeader));
+    memcpy(reply_buffer + sizeof(VBANHeader), &ping_data.raw_data, sizeof(VBANPing0Data));
+    ssize_t sent_len = sendto(sockfd, reply_buffer, sizeof(reply_buffer), 0,
+                              (struct sockaddr *)sender_addr, sender_len);
+    if (sent_len < 0) {
+        perror("sendto");
+    } else {
+        if (quiet == 0) printf("Sent VBAN ping reply to %s:%d\n", inet_ntoa(sender_addr->sin_addr), ntohs(sender_addr->sin_port));
+    }
+}
+
+static void receive_audio(Vban95_Stream* stream, const VBANHeader* header, const char* audio_data, size_t audio_data_size, double arrival) {
+    uint8_t actual_sr_idx = header->protocol_sample_rate_idx & 0x1f;
+    if(stream->last_sr != actual_sr_idx) {
+        stream->last_sr = actual_sr_idx;
+        if(stream->quiet == 0) printf("%s: new sample rate of %ld\n", stream->stream_name, VBAN_SRList[stream->last_sr % VBAN_SR_MAXNUMBER]);
+        stream->audio_reset = true;
+    }
+
+    if(stream->last_format != header->format_type) {
+        stream->last_format = header->format_type;
+        if(stream->quiet == 0) printf("%s: new data format of %s\n", stream->stream_name, VBAN_TextBITList[stream->last_format % VBAN_BIT_MAXNUMBER]); // Here it should be fine to use the modulo, as during the reset we point out the idx may be shit
+        stream->audio_reset = true;
+    }
+
+    if(stream->last_channels != header->sample_channels) {
+        stream->last_channels = header->sample_channels;
+        if(stream->quiet == 0) printf("%s: new channel count of %d\n", stream->stream_name, stream->last_channels + 1); // Add 1 because VBAN channels are 0-based
+        stream->audio_reset = true;
+    }
+
+    if (stream->last_sr >= VBAN_SR_MAXNUMBER || stream->last_format >= VBAN_BIT_MAXNUMBER) {
+        if (stream->audio_reset) fprintf(stderr, "%s: unsupported sample rate or format\n", stream->stream_name);
+        stream->audio_reset = false;
+        return;
+    }
+
+    double packet_duration = (header->samples_per_frame + 1) / (double)VBAN_SRList[stream->last_sr];
+
+    pthread_mutex_lock(&stream->lock);
+    if (stream->audio_reset) {
+        stream->sr_idx = stream->last_sr;
+        stream->format = stream->last_format;
+        stream->channels = stream->last_channels;
+        stream->reconfigure = true;
+        reset_jitter_buffer(&stream->jitter, stream->last_format);
+        stream->audio_reset = false;
+    }
+    stream->packet_duration = packet_duration;
+    push_jitter_buffer(&stream->jitter, header->frame_num, audio_data, audio_data_size, arrival, packet_duration);
+    uint8_t target = stream->jitter.target_depth;
+    pthread_mutex_unlock(&stream->lock);
+
+    if (target != stream->last_target) {
+        if (stream->quiet == 0) printf("%s: buffering %u packets\n", stream->stream_name, target);
+        stream->last_target = target;
+    }
+}
+
+// name,device,buffer,ip, everything after the name can be left out or empty
+static int parse_stream(Vban95_Stream* stream, char* definition, const char* default_ip, int buffer_size, int min_buffer_size) {
+    char* fields[4] = {NULL, NULL, NULL, NULL};
+    for (int i = 0; i < 4 && definition != NULL; i++) fields[i] = strsep(&definition, ",");
 
-void process_audio_buffer(AudioBuffer* buffer, PulseOutputDevice* output_device) {
-    while (buffer->count > 0) {
-        AudioPacket* pkt = &buffer->packets[buffer->tail];
-        write_PulseOutputDevice(output_device, pkt->data, pkt->size);
+    if (fields[0] == NULL || fields[0][0] == '\0' || strlen(fields[0]) > sizeof(((VBANHeader*)0)->streamname)) {
+        fprintf(stderr, "Invalid stream name\n");
+        return -1;
+    }
+    strcpy(stream->stream_name, fields[0]);
+    snprintf(stream->device, sizeof(stream->device), "%s", fields[1] ? fields[1] : "");
+    if (fields[2] != NULL && fields[2][0] != '\0') buffer_size = atoi(fields[2]);
+    const char* ip = (fields[3] != NULL && fields[3][0] != '\0') ? fields[3] : default_ip;
 
-        buffer->tail = (buffer->tail + 1) % buffer->capacity;
-        buffer->count--;
+    if (buffer_size <= 0 || buffer_size > MAX_BUFFER_PACKETS) {
+        fprintf(stderr, "%s: buffer size must be between 1 and %d\n", stream->stream_name, MAX_BUFFER_PACKETS);
+        return -1;
+    }
+    if (inet_pton(AF_INET, ip, &stream->remote) != 1) {
+        fprintf(stderr, "%s: invalid remote IP address: %s\n", stream->stream_name, ip);
+        return -1;
     }
+
+    init_jitter_buffer(&stream->jitter, (min_buffer_size < buffer_size) ? min_buffer_size : buffer_size, buffer_size);
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    stream->buffer_attr = (pa_buffer_attr){
+        .maxlength = buffer_maxlength,
+        .tlength = buffer_tlength_fragsize,
+        .prebuf = buffer_prebuf
+    };
+    stream->audio_reset = true;
+    return 0;
 }
 
-void reset_audio_buffer(AudioBuffer* buffer) {
-    buffer->head = 0;
-    buffer->tail = 0;
-    buffer->count = 0;
+static int read_fully(int fd, char* buffer, size_t size) {
+    while (size > 0) {
+        ssize_t n = read(fd, buffer, size);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        if (n == 0) return -1;
+        buffer += n;
+        size -= n;
+    }
+    return 0;
+}
+
+// Sends a Pulse source or stdin ("-") as VBAN, frames as big as the protocol allows and several per syscall
+static int run_transmitter(char* destination, int port, const char* stream_name, const char* device, int rate, int channels, uint8_t format, int quiet) {
+    int sr_idx = -1;
+    for (int i = 0; i < VBAN_SR_MAXNUMBER; i++) {
+        if (VBAN_SRList[i] == rate) sr_idx = i;
+    }
+    if (sr_idx < 0) {
+        fprintf(stderr, "%d Hz is not a VBAN sample rate\n", rate);
+        return 1;
+    }
+
+    char* port_part = strchr(destination, ':');
+    if (port_part != NULL) {
+        *port_part = '\0';
+        port = atoi(port_part + 1);
+    }
+    struct sockaddr_in dest_addr;
+    memset(&dest_addr, 0, sizeof(dest_addr));
+    dest_addr.sin_family = AF_INET;
+    dest_addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, destination, &dest_addr.sin_addr) != 1) {
+        fprintf(stderr, "Invalid destination IP address: %s\n", destination);
+        return 1;
+    }
+
+    size_t frame_bytes = sample_format_bytes[format] * channels;
+    size_t samples = VBAN_MAX_PAYLOAD / frame_bytes;
+    if (samples > VBAN_MAX_SAMPLES) samples = VBAN_MAX_SAMPLES;
+    if (samples == 0) {
+        fprintf(stderr, "Too many channels for a VBAN frame\n");
+        return 1;
+    }
+    size_t payload = samples * frame_bytes;
+    int batch = (int)(SEND_BATCH_SECONDS * rate / samples);
+    if (batch < 1) batch = 1;
+    if (batch > SEND_BATCH) batch = SEND_BATCH;
+
+    bool from_pipe = strcmp(device, "-") == 0;
+    PulseInputDevice input = {0};
+    if (!from_pipe) {
+        pa_buffer_attr input_buffer_attr = {
+            .maxlength = buffer_maxlength,
+            .fragsize = payload * batch
+        };
+        int result = init_PulseInputDevice(&input, rate, channels, "vban95", stream_name, device, &input_buffer_attr, VBAN_BITList[format]);
+        if (result != 0) {
+            fprintf(stderr, "Failed to initialize PulseAudio input device: %s\n", pa_strerror(result));
+            return 1;
+        }
+    }
+
+    int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sockfd < 0) {
+        perror("socket");
+        if (input.initialized) free_PulseDevice(&input);
+        return 1;
+    }
+
+    // The audio is read straight behind the headers' iovecs, nothing gets copied into packets
+    char* audio = malloc(payload * SEND_BATCH);
+    if (audio == NULL) {
+        perror("malloc");
+        close(sockfd);
+        if (input.initialized) free_PulseDevice(&input);
+        return 1;
+    }
+    VBANHeader headers[SEND_BATCH];
+    struct iovec iovecs[SEND_BATCH][2];
+    struct mmsghdr msgs[SEND_BATCH];
+    memset(headers, 0, sizeof(headers));
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < SEND_BATCH; i++) {
+        memcpy(headers[i].vban, "VBAN", 4);
+        headers[i].protocol_sample_rate_idx = VBAN_PROTOCOL_AUDIO | sr_idx;
+        headers[i].samples_per_frame = samples - 1;
+        headers[i].sample_channels = channels - 1;
+        headers[i].format_type = format;
+        strncpy(headers[i].streamname, stream_name, sizeof(headers[i].streamname));
+
+        iovecs[i][0].iov_base = &headers[i];
+        iovecs[i][0].iov_len = sizeof(VBANHeader);
+        iovecs[i][1].iov_base = audio + i * payload;
+        iovecs[i][1].iov_len = payload;
+        msgs[i].msg_hdr.msg_name = &dest_addr;
+        msgs[i].msg_hdr.msg_namelen = sizeof(dest_addr);
+        msgs[i].msg_hdr.msg_iov = iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 2;
+    }
+
+    if (quiet == 0) printf("Sending %s to %s:%d, %zu samples of %d channel %s at %d Hz per frame, %d frames at once\n", stream_name, destination, port, samples, channels, VBAN_TextBITList[format], rate, batch);
+
+    uint32_t frame_num = 0;
+    int ret = 0;
+    while (to_run) {
+        int error = from_pipe ? read_fully(STDIN_FILENO, audio, payload * batch) : read_PulseInputDevice(&input, audio, payload * batch);
+        if (error != 0) {
+            if (to_run) fprintf(stderr, "Failed to read the input\n");
+            ret = 1;
+            break;
+        }
+
+        for (int i = 0; i < batch; i++) headers[i].frame_num = frame_num++;
+        for (int sent = 0; sent < batch && to_run;) {
+            int n = sendmmsg(sockfd, msgs + sent, batch - sent, 0);
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                perror("sendmmsg");
+                break;
+            }
+            sent += n;
+        }
+    }
+
+    free(audio);
+    close(sockfd);
+    if (input.initialized) free_PulseDevice(&input);
+    return ret;
 }
 
 void show_version() {
-	printf("vban95 (a VBAN AOIP receiver by radio95) version 1.1\n");
+	printf("vban95 (a VBAN AOIP receiver and transmitter by radio95) version 1.5\n");
 }
 void show_help(char *name) {
     printf(
@@ -120,10 +482,17 @@ void show_help(char *name) {
         "\t-i,--ip\t\tOverride remote IP address\n"
         "\t-p,--port\tOverride listen port\n"
         "\t-s,--stream\tOverride stream name\n"
-        "\t-b,--buffer\tOverride buffer size (1 to %d)\n"
+        "\t-b,--buffer\tOverride the maximum buffer size (1 to %d)\n"
+        "\t-m,--min_buffer\tOverride the minimum buffer size, the buffer grows from here with the jitter [default: %d]\n"
         "\t-d,--device\tOverride PulseAudio device\n"
+        "\t-S,--add_stream\tReceive a stream given as name,device,buffer,ip (all but the name optional), can be repeated up to %d times and replaces -s/-d\n"
+        "\t-r,--rate\tOutput sample rate, every stream is converted to it [default: %d]\n"
+        "\t-c,--channels\tOutput channels (1 to %d) [default: %d]\n"
+        "\t-M,--map\tInput channel for each output channel, like 1,0 to swap or 0,-1 to mute the right one\n"
+        "\t-T,--transmit\tSend instead, to this ip[:port], reading -d (a Pulse source or - for stdin) as -s at -r, -c and -F\n"
+        "\t-F,--format\tSample format to send, U08, S16, S24, S32 or F32 [default: S16]\n"
         "\t-q,--quiet\tSuppress output messages\n",
-        name, MAX_BUFFER_PACKETS
+        name, MAX_BUFFER_PACKETS, DEFAULT_MIN_BUFFER, MAX_STREAMS, DEFAULT_OUTPUT_RATE, MAX_REMAP_CHANNELS, DEFAULT_OUTPUT_CHANNELS
     );
 }
 
@@ -134,17 +503,32 @@ int main(int argc, char *argv[]) {
     int listen_port = 6980;
     char *stream_name = "VBAN";
     int buffer_size = 8;
+    int min_buffer_size = DEFAULT_MIN_BUFFER;
     char *pulse_device = "";
     int quiet = 0;
-    
+    char *stream_definitions[MAX_STREAMS];
+    int stream_definition_count = 0;
+    int output_rate = DEFAULT_OUTPUT_RATE;
+    int output_channels = DEFAULT_OUTPUT_CHANNELS;
+    char *channel_map_arg = NULL;
+    char *transmit_to = NULL;
+    uint8_t transmit_format = SAMPLE_S16;
+
     int opt;
-    const char *short_opt = "i:p:s:b:d:qh";
+    const char *short_opt = "i:p:s:b:m:d:S:r:c:M:T:F:qh";
     const struct option long_opt[] = {
         {"ip", required_argument, NULL, 'i'},
         {"port", required_argument, NULL, 'p'},
         {"stream", required_argument, NULL, 's'},
         {"buffer", required_argument, NULL, 'b'},
+        {"min_buffer", required_argument, NULL, 'm'},
         {"device", required_argument, NULL, 'd'},
+        {"add_stream", required_argument, NULL, 'S'},
+        {"rate", required_argument, NULL, 'r'},
+        {"channels", required_argument, NULL, 'c'},
+        {"map", required_argument, NULL, 'M'},
+        {"transmit", required_argument, NULL, 'T'},
+        {"format", required_argument, NULL, 'F'},
         {"quiet", no_argument, NULL, 'q'},
         {"help", no_argument, NULL, 'h'},
         {NULL, 0, NULL, 0}
@@ -163,9 +547,41 @@ int main(int argc, char *argv[]) {
             case 'b':
                 buffer_size = atoi(optarg);
                 break;
+            case 'm':
+                min_buffer_size = atoi(optarg);
+                break;
             case 'd':
                 pulse_device = optarg;
                 break;
+            case 'S':
+                if (stream_definition_count == MAX_STREAMS) {
+                    fprintf(stderr, "At most %d streams are supported\n", MAX_STREAMS);
+                    return 1;
+                }
+                stream_definitions[stream_definition_count++] = optarg;
+                break;
+            case 'r':
+                output_rate = atoi(optarg);
+                break;
+            case 'c':
+                output_channels = atoi(optarg);
+                break;
+            case 'M':
+                channel_map_arg = optarg;
+                break;
+            case 'T':
+                transmit_to = optarg;
+                break;
+            case 'F':
+                transmit_format = VBAN_BIT_MAXNUMBER;
+                for (uint8_t i = 0; i < VBAN_BIT_MAXNUMBER; i++) {
+                    if (strcasecmp(optarg, VBAN_TextBITList[i]) == 0) transmit_format = i;
+                }
+                if (transmit_format == VBAN_BIT_MAXNUMBER) {
+                    fprintf(stderr, "Unknown sample format: %s\n", optarg);
+                    return 1;
+                }
+                break;
             case 'q':
                 quiet = 1;
                 break;
@@ -178,12 +594,66 @@ int main(int argc, char *argv[]) {
         }
     }
 
-    if (buffer_size <= 0 || buffer_size > MAX_BUFFER_PACKETS) {
-        fprintf(stderr, "Buffer size must be between 1 and %d\n", MAX_BUFFER_PACKETS);
+    if (min_buffer_size <= 0 || min_buffer_size > MAX_BUFFER_PACKETS) {
+        fprintf(stderr, "Minimum buffer size must be between 1 and %d\n", MAX_BUFFER_PACKETS);
+        return 1;
+    }
+
+    if (output_rate <= 0) {
+        fprintf(stderr, "Invalid output sample rate\n");
+        return 1;
+    }
+    if (output_channels <= 0 || output_channels > MAX_REMAP_CHANNELS) {
+        fprintf(stderr, "Output channels must be between 1 and %d\n", MAX_REMAP_CHANNELS);
         return 1;
     }
 
-    printf("Starting VBAN receiver with buffer size: %d packets\n", buffer_size);
+    if (transmit_to != NULL) {
+        signal(SIGINT, stop);
+        signal(SIGTERM, stop);
+        return run_transmitter(transmit_to, listen_port, stream_name, pulse_device, output_rate, output_channels, transmit_format, quiet);
+    }
+
+    int16_t channel_map[MAX_REMAP_CHANNELS];
+    bool use_channel_map = (channel_map_arg != NULL);
+    if (use_channel_map) {
+        int mapped = 0;
+        for (char* field = strsep(&channel_map_arg, ","); field != NULL; field = strsep(&channel_map_arg, ",")) {
+            if (mapped == output_channels) break;
+            channel_map[mapped++] = atoi(field);
+        }
+        if (mapped != output_channels) {
+            fprintf(stderr, "The channel map needs one entry per output channel\n");
+            return 1;
+        }
+    }
+
+    struct in_addr remote_addr_bin;
+    if (inet_pton(AF_INET, remote_ip, &remote_addr_bin) != 1) {
+        fprintf(stderr, "Invalid remote IP address: %s\n", remote_ip);
+        return 1;
+    }
+
+    static Vban95_Streams streams;
+    char single_stream[128];
+    if (stream_definition_count == 0) {
+        snprintf(single_stream, sizeof(single_stream), "%s,%s", stream_name, pulse_device);
+        stream_definitions[stream_definition_count++] = single_stream;
+    }
+    for (int i = 0; i < stream_definition_count; i++) {
+        Vban95_Stream* stream = &streams.streams[streams.count];
+        if (parse_stream(stream, stream_definitions[i], remote_ip, buffer_size, min_buffer_size) != 0) return 1;
+        stream->quiet = quiet;
+        stream->out_rate = output_rate;
+        stream->out_channels = output_channels;
+        stream->explicit_map = use_channel_map ? channel_map : NULL;
+        if (add_stream(&streams, stream) != 0) {
+            fprintf(stderr, "Stream %s is given twice\n", stream->stream_name);
+            return 1;
+        }
+        streams.count++;
+        printf("Receiving %s with buffer size: %d to %d packets\n", stream->stream_name, stream->jitter.min_depth, stream->jitter.max_depth);
+    }
 
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
     if (sockfd < 0) {
@@ -214,204 +684,123 @@ int main(int argc, char *argv[]) {
         return 1;
     }
 
-    struct in_addr remote_addr_bin;
-    if (inet_pton(AF_INET, remote_ip, &remote_addr_bin) != 1) {
-        fprintf(stderr, "Invalid remote IP address: %s\n", remote_ip);
+    int epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        perror("epoll_create1");
         close(sockfd);
         return 1;
     }
-
-    char buffer[BUF_SIZE];
-    struct sockaddr_in sender_addr;
-    socklen_t sender_len = sizeof(sender_addr);
-
-    // uint32_t vban_frame = 0;
-    uint8_t vban_last_sr = 0;
-    uint8_t vban_last_format = 0;
-    uint8_t vban_last_channels = 0;
-    uint8_t vban_audio_reset = 0;
-
-    AudioBuffer* audio_buffer = create_audio_buffer(buffer_size);
-    if (!audio_buffer) {
+    struct epoll_event ev = {.events = EPOLLIN, .data.fd = sockfd};
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, sockfd, &ev) < 0) {
+        perror("epoll_ctl");
+        close(epfd);
         close(sockfd);
         return 1;
     }
 
-    pa_buffer_attr buffer_attr = {
-        .maxlength = buffer_maxlength,
-        .tlength = buffer_tlength_fragsize,
-        .prebuf = buffer_prebuf
-    };
+    static char buffers[RECV_BATCH][BUF_SIZE];
+    struct sockaddr_in sender_addrs[RECV_BATCH];
+    struct iovec iovecs[RECV_BATCH];
+    struct mmsghdr msgs[RECV_BATCH];
+    memset(msgs, 0, sizeof(msgs));
+    for (int i = 0; i < RECV_BATCH; i++) {
+        iovecs[i].iov_base = buffers[i];
+        iovecs[i].iov_len = BUF_SIZE;
+        msgs[i].msg_hdr.msg_iov = &iovecs[i];
+        msgs[i].msg_hdr.msg_iovlen = 1;
+        msgs[i].msg_hdr.msg_name = &sender_addrs[i];
+    }
 
     signal(SIGINT, stop);
     signal(SIGTERM, stop);
 
+    uint8_t started = 0;
+    for (; started < streams.count; started++) {
+        if (pthread_create(&streams.streams[started].writer, NULL, writer_thread, &streams.streams[started]) != 0) {
+            perror("pthread_create");
+            to_run = 0;
+            break;
+        }
+    }
+
+    int received = 0;
     while (to_run) {
-        ssize_t recv_len = recvfrom(sockfd, buffer, BUF_SIZE, 0, (struct sockaddr *)&sender_addr, &sender_len);
-        if (recv_len < 0) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                usleep(POLL_TIMEOUT_MS * 1000);
-                continue;
-            } else {
-                perror("recvfrom error");
+        // Only wait when the last batch has drained the socket
+        if (received < RECV_BATCH) {
+            struct epoll_event event;
+            int ready = epoll_wait(epfd, &event, 1, EPOLL_TIMEOUT_MS);
+            if (ready < 0) {
+                if (errno == EINTR) continue;
+                perror("epoll_wait");
                 break;
             }
+            if (ready == 0) continue;
         }
 
-        if ((size_t)recv_len < sizeof(VBANHeader)) continue;
+        for (int i = 0; i < RECV_BATCH; i++) msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+        received = recvmmsg(sockfd, msgs, RECV_BATCH, MSG_DONTWAIT, NULL);
+        if (received < 0) {
+            received = 0;
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR) continue;
+            perror("recvmmsg");
+            break;
+        }
 
-        if (sender_addr.sin_addr.s_addr == remote_addr_bin.s_addr || remote_addr_bin.s_addr == 0) {
-            VBANHeaderUnion data;
-            memcpy(&data.raw_data, buffer, sizeof(VBANHeader));
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double arrival = now.tv_sec + now.tv_nsec / 1e9;
+
+        // Wake every writer that got something once the whole batch is in
+        bool touched[MAX_STREAMS] = {false};
 
-            if (memcmp(data.packet_data.vban, "VBAN", 4) != 0) continue;
+        for (int m = 0; m < received; m++) {
+            char* buffer = buffers[m];
+            ssize_t recv_len = msgs[m].msg_len;
+            const struct sockaddr_in* sender_addr = &sender_addrs[m];
+
+            VBANHeaderUnion data;
+            int protocol = parse_vban_header(buffer, recv_len, &data.packet_data);
+            if (protocol < 0) continue;
 
-            uint8_t protocol = data.packet_data.protocol_sample_rate_idx & 0xe0;
             if(protocol != VBAN_PROTOCOL_AUDIO) {
-                if(protocol == VBAN_PROTOCOL_SERVICE) {
+                if(protocol == VBAN_PROTOCOL_SERVICE && (sender_addr->sin_addr.s_addr == remote_addr_bin.s_addr || remote_addr_bin.s_addr == 0)) {
                     // Handle Service protocol
                     uint8_t service_type = data.packet_data.sample_channels;
                     uint8_t service_function = data.packet_data.samples_per_frame; // 0 if ping, 80 if reply
 
-                    if(service_type == VBAN_SERVICE_IDENTIFICATION) {
-                        if(service_function == 0) {
-                            // Handle ping
-                            VBANPing0DataUnion ping_data;
-                            memset(&ping_data, 0, sizeof(VBANPing0Data));
-
-                            ping_data.data.bitType = VBANPING_TYPE_RECEPTOR;
-                            ping_data.data.bitfeature = VBANPING_FEATURE_AUDIO | VBANPING_FEATURE_AOIP;
-                            ping_data.data.nVersion[0] = 1;
-                            ping_data.data.nVersion[1] = 1;
-
-                            snprintf(ping_data.data.DistantIP_ascii, sizeof(ping_data.data.DistantIP_ascii), "%s", inet_ntoa(sender_addr.sin_addr));
-                            ping_data.data.DistantPort = htons(listen_port);
-                            strncpy(ping_data.data.ApplicationName_ascii, "vban95", sizeof(ping_data.data.ApplicationName_ascii));
-
-                            uid_t uid = getuid();
-                            struct passwd *pw = getpwuid(uid);
-                            if (pw != NULL) snprintf(ping_data.data.UserName_utf8, sizeof(ping_data.data.UserName_utf8), "%s", pw->pw_name);
-
-                            gethostname(ping_data.data.HostName_ascii, sizeof(ping_data.data.HostName_ascii));
-
-                            VBANHeaderUnion reply_header;
-                            memset(&reply_header, 0, sizeof(VBANHeader));
-
-                            memcpy(reply_header.packet_data.vban, "VBAN", 4);
-                            reply_header.packet_data.protocol_sample_rate_idx = VBAN_PROTOCOL_SERVICE;
-                            reply_header.packet_data.sample_channels = VBAN_SERVICE_IDENTIFICATION;
-                            reply_header.packet_data.samples_per_frame = 0x80; // reply
-                            reply_header.packet_data.frame_num = data.packet_data.frame_num;
-
-                            char reply_buffer[sizeof(VBANHeader) + sizeof(VBANPing0Data)];
-                            memcpy(reply_buffer, &reply_header.raw_data, sizeof(VBANHeader));
-                            memcpy(reply_buffer + sizeof(VBANHeader), &ping_data.raw_data, sizeof(VBANPing0Data));
-                            ssize_t sent_len = sendto(sockfd, reply_buffer, sizeof(reply_buffer), 0,
-                                                      (struct sockaddr *)&sender_addr, sender_len);
-                            if (sent_len < 0) {
-                                perror("sendto");
-                            } else {
-                                if (quiet == 0) printf("Sent VBAN ping reply to %s:%d\n", inet_ntoa(sender_addr.sin_addr), ntohs(sender_addr.sin_port));
-                            }
-                        }
-                    }
+                    if(service_type == VBAN_SERVICE_IDENTIFICATION && service_function == 0) send_ping_reply(sockfd, &data.packet_data, sender_addr, msgs[m].msg_hdr.msg_namelen, listen_port, quiet);
                 }
                 continue;
             }
 
-            if (strncmp(data.packet_data.streamname, stream_name, sizeof(data.packet_data.streamname)) != 0) continue;
-            
-            char* audio_data = buffer + sizeof(VBANHeader);
-            size_t audio_data_size = recv_len - sizeof(VBANHeader);
-#if 0
-            if (vban_frame == 0) {
-                vban_frame = data.packet_data.frame_num;
-            } else {
-                int32_t diff = (int32_t)(data.packet_data.frame_num - (vban_frame++) - 1);
-                if(diff != 0) {
-                    debug_printf("Frame number diff: %d\n", diff);
-                    if(diff == 0) {
-                        if (quiet == 0) printf("Duplicate packet received\n");
-                    } else if (diff > 1) {
-                        if (quiet == 0) printf("Dropped %u packets\n", diff);
-                        
-                        AudioPacket blank_packet;
-                        uint8_t fill_value = (data.packet_data.format_type == 0) ? 0 : 128;
-                        memset(blank_packet.data, fill_value, audio_data_size);
-                        blank_packet.size = audio_data_size;
-
-                        VBANHeaderUnion temp;
-                        memset(blank_packet.data, 0, blank_packet.size);
-                        memcpy(&temp.raw_data, buffer, sizeof(VBANHeader));
-
-                        for (uint32_t i = diff; i < temp.packet_data.frame_num; i++) {
-                            temp.packet_data.frame_num = i;
-                            add_to_buffer(audio_buffer, blank_packet.data, blank_packet.size, &temp.packet_data);
-                        }
-                    } else if (diff < 1) {
-                        if (quiet == 0) printf("Packets received out of order (got:%u, expected:%u)\n", 
-                                            data.packet_data.frame_num, vban_frame);
-                    }
-                    vban_frame = data.packet_data.frame_num;
-                }
-            }
-#endif
-
-            uint8_t actual_sr_idx = data.packet_data.protocol_sample_rate_idx & 0x1f;
-            if(vban_last_sr != actual_sr_idx) {
-                vban_last_sr = actual_sr_idx;
-                if(quiet == 0) printf("New sample rate of %ld\n", VBAN_SRList[vban_last_sr % VBAN_SR_MAXNUMBER]);
-                vban_audio_reset = 1;
-                reset_audio_buffer(audio_buffer);
-            }
-            
-            if(vban_last_format != data.packet_data.format_type) {
-                vban_last_format = data.packet_data.format_type;
-                if(quiet == 0) printf("New data format of %s\n", VBAN_TextBITList[vban_last_format % VBAN_BIT_MAXNUMBER]); // Here it should be fine to use the modulo, as during the reset we point out the idx may be shit
-                vban_audio_reset = 1;
-                reset_audio_buffer(audio_buffer);
-            }
-            
-            if(vban_last_channels != data.packet_data.sample_channels) {
-                vban_last_channels = data.packet_data.sample_channels;
-                if(quiet == 0) printf("New channel count of %d\n", vban_last_channels + 1); // Add 1 because VBAN channels are 0-based
-                vban_audio_reset = 1;
-                reset_audio_buffer(audio_buffer);
-            }
-
-            if(vban_audio_reset) {
-                if (vban_last_sr >= VBAN_SR_MAXNUMBER || vban_last_format >= VBAN_BIT_MAXNUMBER) {
-                    fprintf(stderr, "Unsupported sample rate or format\n");
-                    continue;
-                }
+            Vban95_Stream* stream = find_stream(&streams, data.packet_data.streamname);
+            if (stream == NULL) continue;
+            if (sender_addr->sin_addr.s_addr != stream->remote.s_addr && stream->remote.s_addr != 0) continue;
 
-                if (output.initialized) free_PulseDevice(&output);
-                
-                int result = init_PulseOutputDevice(
-                    &output, 
-                    VBAN_SRList[vban_last_sr], 
-                    vban_last_channels + 1, // Add 1 because VBAN channels are 0-based
-                    "vban95", 
-                    stream_name, 
-                    pulse_device, 
-                    &buffer_attr,
-                    VBAN_BITList[vban_last_format]
-                );
-                
-                if (result != 0) fprintf(stderr, "Failed to initialize PulseAudio output device: %s\n", pa_strerror(result));
-                
-                vban_audio_reset = 0;
-                continue;
-            }
+            receive_audio(stream, &data.packet_data, buffer + sizeof(VBANHeader), recv_len - sizeof(VBANHeader), arrival);
+            touched[stream - streams.streams] = true;
+        }
 
-            if (add_to_buffer(audio_buffer, audio_data, audio_data_size, &data.packet_data) > 0) process_audio_buffer(audio_buffer, &output);
+        for (uint8_t i = 0; i < streams.count; i++) {
+            if (touched[i]) pthread_cond_signal(&streams.streams[i].cond);
         }
     }
 
     // Clean up
     printf("Cleaning up...\n");
-    if (output.initialized) free_PulseDevice(&output);
-    destroy_audio_buffer(audio_buffer);
+    to_run = 0;
+    for (uint8_t i = 0; i < started; i++) {
+        Vban95_Stream* stream = &streams.streams[i];
+        pthread_cond_signal(&stream->cond);
+        pthread_join(stream->writer, NULL);
+        if (quiet == 0) {
+            printf("%s: received %u packets, %u late, %u duplicate, %u concealed, %u dropped\n", stream->stream_name, stream->jitter.received, stream->jitter.late, stream->jitter.duplicate, stream->jitter.concealed, stream->jitter.dropped);
+            printf("%s: sender clock was %+.1f ppm off ours\n", stream->stream_name, stream->drift.integral * 1e6);
+        }
+        if (stream->output.initialized) free_PulseDevice(&stream->output);
+        exit_asrc(&stream->asrc);
+    }
+    close(epfd);
     close(sockfd);
     
     return 0;